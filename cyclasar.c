@@ -43,7 +43,12 @@
 //
 //  1. Compile this file on either of FreeBSD, Linux or macOS:
 //
-//     cc -g0 -O3 cyclasar.c -Wno-parentheses -I/usr/local/include/ffts -L/usr/local/lib -lffts -lm -o cyclasar
+//     cc -g0 -O3 cyclasar.c -Wno-parentheses -I/usr/local/include/ffts -L/usr/local/lib -lffts -lpthread -lm -o cyclasar
+//
+//     For double precision transforms, define DOUBLE_PRECISION - FFTS works in single precision only,
+//     and therefore in this case it is replaced by the built-in double precision kernel:
+//
+//     cc -g0 -O3 -DDOUBLE_PRECISION cyclasar.c -Wno-parentheses -lpthread -lm -o cyclasar
 //
 //  2. Download the daily time series of the sun's acitve regions
 //     from solarcyclescience.com - http://solarcyclescience.com/AR_Database/daily_area.txt
@@ -63,6 +68,50 @@
 //
 //     ./cyclasar filter 0 0.001 10 sar-1880-2021.tsv filtered-sar-1880-2021.tsv
 //
+//     Large transforms are decomposed into cache sized row and column transforms (four-step FFT),
+//     which are distributed over all available cores. The number of threads may be given explicitly:
+//
+//     ./cyclasar -t 8 spectrum sar-1880-2021.tsv spectral-sar-1880-2021.tsv
+//
+//     For very large series, the low memory mode transforms the data in place. With FFTS, transforms
+//     of up to 262144 points still take a scratch copy, so that this pays off for larger series only:
+//
+//     ./cyclasar -m filter 0 0.001 10 sar-1880-2021.tsv filtered-sar-1880-2021.tsv
+//
+//     For routine smoothing, the time domain smoothers stream the series and cost O(n), regardless
+//     of the window width, e.g. the 27-day solar rotation boxcar:
+//
+//     ./cyclasar smooth boxcar 27 sar-1880-2021.tsv smoothed-sar-1880-2021.tsv
+//
+//     When tuning the filter, the detrended forward spectrum may be kept in a cache file or directory,
+//     so that subsequent runs on the unchanged input skip the parsing and the forward transform:
+//
+//     ./cyclasar -c /tmp filter 0 0.001 10 sar-1880-2021.tsv filtered-sar-1880-2021.tsv
+//
+//     The low-pass filtered series may be decimated, here to every 106th day, so that only the
+//     needed points are computed and written out, and the time base in the header is adjusted.
+//     The factor should divide the number of points, 51728 = 16·53·61 in this case, otherwise
+//     the full backward transform is computed. The pass band including the blur of the cut must
+//     stay below half of the decimated sampling rate:
+//
+//     ./cyclasar -d 106 filter 0 0.001 10 sar-1880-2021.tsv filtered-sar-1880-2021.tsv
+//
+//     The drift of the cycle length and amplitude over time shows up in the scalogram of the
+//     continuous wavelet transform, here with the Morlet wavelet ω0 = 6 and 8 scales per octave:
+//
+//     ./cyclasar wavelet morlet 6 0.125 sar-1880-2021.tsv wavelet-sar-1880-2021.tsv
+//
+//     The periods, amplitudes and phases of the strongest cycles are estimated by the peaks method,
+//     which refines the spectral maxima by interpolation, and fits the sinusoids jointly to the series:
+//
+//     ./cyclasar peaks 5 quinn sar-1880-2021.tsv peaks-sar-1880-2021.tsv
+//
+//     For interactive work, a local analysis server keeps the series and their spectra resident,
+//     and answers spectrum, filter and band queries over a Unix domain socket:
+//
+//     ./cyclasar -t 4 serve /tmp/cyclasar.sock &
+//     ./cyclasar query /tmp/cyclasar.sock band sar-1880-2021.tsv 0.00025 0.00030
+//
 //  6. Open the resulting TSV files with your favorite graphing and/or data analysis application,
 //     for example with CVA - https://cyclaero.com/en/downloads/CVA
 
@@ -73,232 +122,2475 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <x86intrin.h>
 #include <math.h>
 
-#include "ffts.h"
+#if defined(DOUBLE_PRECISION)
+   typedef double real;
+   #define strtor strtod
+#else
+   #include "ffts.h"
+   typedef float  real;
+   #define strtor strtof
+#endif
 
 
 int usage(void)
 {
    printf(" Usage:\n"
-          "   ./cyclasar <method> [filter args] <infile> <outfile>\n"
-          "     method:        either of 'spectrum' or 'filter'\n"
+          "   ./cyclasar [-t threads] [-m] [-c cache] [-d factor] <method> [filter args | smooth args | wavelet args | peaks args] <infile> <outfile>\n"
+          "     threads:       number of threads for large transforms and wavelet scales, default is the number of cores\n"
+          "     -m:            low memory mode, transform in place (with FFTS, series of more than 262144 points only)\n"
+          "     cache:         spectrum cache file, or directory of spectrum cache files\n"
+          "     factor:        decimation of the filtered series, write only every factor-th point\n"
+          "     method:        either of 'spectrum', 'filter', 'smooth', 'wavelet' or 'peaks'\n"
           "     filter args:   <low> <high> <kT>  (apply for the filter method only)\n"
           "             low:   0 .. +inf -- frequency in unit of the reciprocal base time\n"
           "            high:   0 .. +inf -- frequency in unit of the reciprocal base time\n"
           "              kT:   0 .. 100  -- blur of the cut(s) in percent of the passed frequency range\n"
+          "     smooth args:   <kind> <width>  (apply for the smooth method only)\n"
+          "            kind:   'mean'   -- moving average\n"
+          "                    'boxcar' -- 3 cascaded moving averages\n"
+          "                    'exp'    -- exponential smoothing with alpha = 2/(width + 1)\n"
+          "                    'sg'     -- quadratic Savitzky-Golay smoothing, odd width >= 3\n"
+          "           width:   1 .. 100000 -- window width in data points\n"
+          "     wavelet args:  <mother> <param> <dj>  (apply for the wavelet method only)\n"
+          "          mother:   'morlet' or 'paul'\n"
+          "           param:   0 .. 100  -- nondimensional frequency ω0 of morlet (6), or order m of paul (4)\n"
+          "              dj:   0 .. 1    -- spacing of the scales in octaves, e.g. 0.125\n"
+          "     peaks args:    <count> <interpolation>  (apply for the peaks method only)\n"
+          "           count:   1 .. 64   -- number of the strongest spectral maxima\n"
+          "   interpolation:   'parabolic' or 'quinn' -- refinement of the frequencies between the bins\n"
+          "\n"
+          "   ./cyclasar [-t threads] serve <socket>\n"
+          "     threads:       number of worker threads, default is the number of cores\n"
+          "\n"
+          "   ./cyclasar query <socket> <request>\n"
+          "     request:       'spectrum <file> [binary]'\n"
+          "                    'filter <file> <low> <high> <kT> [binary]'\n"
+          "                    'band <file> <low> <high>'\n"
           "\n");
 
    return 1;
 }
 
 
-static inline float sqrf(float x)
+// Parallel Loop
+
+typedef void (*loopTask)(void *context, size_t index, int thread);
+
+typedef struct
 {
-   return x*x;
-}
+   loopTask task;
+   void    *context;
+   size_t   count, next;
+} loop_job;
 
-float blurfunc(float f, float lowCut, float highCut, float kT, bool invert)
+typedef struct
 {
-   float result;
+   loop_job *job;
+   int       thread;
+} loop_worker;
 
-   if (lowCut == highCut)
-      return 0;
+static void *loopWorker(void *arg)
+{
+   loop_worker *w = arg;
+   size_t index;
+   while ((index = __atomic_fetch_add(&w->job->next, 1, __ATOMIC_RELAXED)) < w->job->count)
+      w->job->task(w->job->context, index, w->thread);
+   return NULL;
+}
 
-   if (0 < kT && kT <= 100)
-      if (lowCut == 0)
-         result = 1/(1 + expf((f - highCut)/kT));
-      else
-         result = 1/(1 + expf((f - highCut)/kT))/(1 + expf((lowCut - f)/kT));
+// Run task(context, index, thread) for index = 0 .. count-1 on the given number of threads.
+// The indexes are handed out one by one, and thread is in the range 0 .. threads-1,
+// so that the task may use per-thread scratch memory.
+void parallelLoop(int threads, size_t count, loopTask task, void *context)
+{
+   if (threads > count)
+      threads = (int)count;
 
-   else if (lowCut <= f && (f <= highCut || isinf(highCut)))
-      result = 1;
+   loop_job    job = {task, context, count, 0};
+   loop_worker workers[threads];
+   pthread_t   tids[threads];
 
-   else
-      result = 0;
+   int t;
+   for (t = 0; t < threads; t++)
+   {
+      workers[t] = (loop_worker){&job, t};
+      if (t > 0 && pthread_create(&tids[t], NULL, loopWorker, &workers[t]) != 0)
+         break;
+   }
 
-   return (invert) ? 1 - result : result;
+   if (threads > 0)
+      loopWorker(&workers[0]);
+
+   while (--t > 0)
+      pthread_join(tids[t], NULL);
 }
 
 
-enum { spectrum = 1, filter = 0 };
+// FFT Kernel
 
-int main(int argc, const char *argv[])
-{
-   FILE *infile, *outfile;
+#if defined(DOUBLE_PRECISION)
 
-   int   rc      = 0,
-         argidx  = 1,
-         method  = 0;
+   // FFTS does single precision only, and so the double precision kernel is built-in.
+   // Power of 2 lengths are transformed in place by an iterative radix-2 algorithm,
+   // other lengths are mapped by Bluestein's algorithm to a radix-2 convolution.
 
-   float lowCut  = 0.0f,
-         highCut = INFINITY,
-         kT      = 0.0f;
+   #define FFT_FORWARD  -1
+   #define FFT_BACKWARD +1
 
-   if (argc == 4 && strcmp(argv[argidx], "spectrum") == 0)
-      method = spectrum;
+   typedef struct
+   {
+      size_t  n, m;        // transform length, radix-2 length
+      int     sign;
+      double *w;           // radix-2 twiddles exp(-2πik/m), k = 0 .. m/2-1
+      double *chirp;       // Bluestein chirp exp(sign·πik²/n), k = 0 .. n-1
+      double *kernel;      // Bluestein convolution kernel, transformed, scaled by 1/m
+      double *work;        // Bluestein scratch of length m
+   } kernel_plan;
 
-   else if (argc == 7 && strcmp(argv[argidx], "filter") == 0)
+   static void radix2(size_t m, const double *w, double *x, int sign)
    {
-      method = filter;
-      lowCut  = strtof(argv[++argidx], NULL);
-      highCut = strtof(argv[++argidx], NULL);
-      kT      = strtof(argv[++argidx], NULL);
+      size_t i, j, k, l, h;
+      for (i = 1, j = 0; i < m; i++)
+      {
+         for (k = m >> 1; j & k; k >>= 1)
+            j ^= k;
+         j |= k;
+         if (i < j)
+         {
+            double re = x[2*i], im = x[2*i+1];
+            x[2*i] = x[2*j], x[2*i+1] = x[2*j+1];
+            x[2*j] = re,     x[2*j+1] = im;
+         }
+      }
 
-      if ( lowCut < 0 || isnan(lowCut)
-       || highCut < 0 || isnan(highCut)
-       || kT < 0 || 100 < kT)
-         return usage();
+      for (l = 2; l <= m; l <<= 1)
+      {
+         h = l >> 1;
+         size_t step = m/l;
+         for (i = 0; i < m; i += l)
+            for (k = 0; k < h; k++)
+            {
+               double wr = w[2*k*step], wi = (sign < 0) ? w[2*k*step+1] : -w[2*k*step+1];
+               double *a = x + 2*(i + k), *b = a + 2*h;
+               double re = b[0]*wr - b[1]*wi,
+                      im = b[0]*wi + b[1]*wr;
+               b[0] = a[0] - re, b[1] = a[1] - im;
+               a[0] += re,       a[1] += im;
+            }
+      }
    }
 
-   else
-      return usage();
-
-   if (infile = (*(uint16_t *)argv[++argidx] == *(uint16_t *)"-")
-                 ? stdin
-                 : fopen(argv[argidx], "r"))
+   kernel_plan *kernelInit(size_t n, int sign)
    {
-      if (outfile = (*(uint16_t *)argv[++argidx] == *(uint16_t *)"-")
-                    ? stdout
-                    : fopen(argv[argidx], "w"))
+      kernel_plan *p = calloc(1, sizeof(kernel_plan));
+      size_t k;
+
+      p->n = n;
+      p->sign = sign;
+      for (p->m = 1; p->m < n; p->m <<= 1);
+      if (p->m != n)
+         for (p->m = 1; p->m < 2*n - 1; p->m <<= 1);
+
+      p->w = malloc(p->m*sizeof(double));
+      for (k = 0; k < p->m/2; k++)
       {
-         int i, n = 65536;
+         p->w[2*k]   =  cos(2*M_PI*k/p->m);
+         p->w[2*k+1] = -sin(2*M_PI*k/p->m);
+      }
 
-         double timebase = 1;
-         char  *timeunit = "d";
-         char  *line, buf[256];
-         while (*(line = fgets(buf, 256, infile)) == '#')
+      if (p->m != n)
+      {
+         p->chirp  = malloc(2*n*sizeof(double));
+         p->kernel = calloc(2*p->m, sizeof(double));
+         p->work   = malloc(2*p->m*sizeof(double));
+         for (k = 0; k < n; k++)
          {
-            fprintf(outfile, "%s", line);
+            double phi = M_PI*(double)((uint64_t)k*k % (2*n))/n;
+            p->chirp[2*k]   = cos(phi);
+            p->chirp[2*k+1] = sign*sin(phi);
+         }
 
-            if (strstr(line, "# Time base:   "))
-               timebase = strtod(line+15, NULL);
+         p->kernel[0] = 1/(double)p->m;
+         for (k = 1; k < n; k++)
+         {
+            p->kernel[2*k]   = p->kernel[2*(p->m-k)]   =  p->chirp[2*k]/p->m;
+            p->kernel[2*k+1] = p->kernel[2*(p->m-k)+1] = -p->chirp[2*k+1]/p->m;
+         }
+         radix2(p->m, p->w, p->kernel, FFT_FORWARD);
+      }
 
-            if (strstr(line, "# Time unit:   "))
-            {
-               for (line += 15, i = 0; (unsigned char)line[i] >= ' '; i++);
-               line[i] = '\0';
-               timeunit = strcpy(alloca(i+1), line);
-            }
+      return p;
+   }
+
+   // in and out may be the same buffer
+   #define KERNEL_INPLACE true
+
+   void kernelExecute(kernel_plan *p, const double *in, double *out)
+   {
+      size_t k, n = p->n, m = p->m;
+
+      if (m == n)
+      {
+         if (out != in)
+            memcpy(out, in, 2*n*sizeof(double));
+         radix2(m, p->w, out, p->sign);
+      }
 
-            if (strstr(line, "# Point count: "))
-               n = (int)strtol(line+15, NULL, 10);
+      else
+      {
+         double *x = p->work, *c = p->chirp, *h = p->kernel;
+         for (k = 0; k < n; k++)
+         {
+            x[2*k]   = in[2*k]*c[2*k] - in[2*k+1]*c[2*k+1];
+            x[2*k+1] = in[2*k]*c[2*k+1] + in[2*k+1]*c[2*k];
          }
+         memset(x + 2*n, 0, 2*(m - n)*sizeof(double));
 
-         if (n > 2)
+         radix2(m, p->w, x, FFT_FORWARD);
+         for (k = 0; k < m; k++)
          {
-            // the line with the column titles has just been read in, and will be implicitely skiped below
-            char *timescale;
-            
-            // skip whitespace and non-printing chars
-            while ((unsigned char)*line && (unsigned char)*line <= ' ')
-               line++;
-            if ('0' <= *line && *line <= '9')
-               timescale = "t/a";
-            else
-            {
-               for (i = 0; (unsigned char)line[i] > ' '; i++);
-               line[i] = '\0';
-               timescale = strcpy(alloca(i+1), line);
-            }
+            double re = x[2*k]*h[2*k] - x[2*k+1]*h[2*k+1];
+            x[2*k+1]  = x[2*k]*h[2*k+1] + x[2*k+1]*h[2*k];
+            x[2*k]    = re;
+         }
+         radix2(m, p->w, x, FFT_BACKWARD);
+
+         for (k = 0; k < n; k++)
+         {
+            out[2*k]   = x[2*k]*c[2*k] - x[2*k+1]*c[2*k+1];
+            out[2*k+1] = x[2*k]*c[2*k+1] + x[2*k+1]*c[2*k];
+         }
+      }
+   }
 
-            float *time = malloc(n*sizeof(float));
+   void kernelFree(kernel_plan *p)
+   {
+      if (p)
+      {
+         free(p->work);
+         free(p->kernel);
+         free(p->chirp);
+         free(p->w);
+         free(p);
+      }
+   }
 
-            float *input, *output;
-            posix_memalign((void **)&input,  32, 2*n*sizeof(float));
-            posix_memalign((void **)&output, 32, 2*n*sizeof(float));
-            for (i = 0; i < n; i++)
-            {
-               line = fgets(buf, 256, infile);
-               time[i]        = strtof(line, &line);     // first column is the time - simply pass through
-               input[2*i    ] = strtof(line, &line);     // second column is the daily total active area of the sun
-               input[2*i + 1] = 0;
-            }
+#else
 
-            // trend correction
-            bool   trend;
-            double a = 0, b = 0, d;
-            for (i = 0; i < 10; i++)
-               a += input[2*i];
-            for (i = n-10; i < n; i++)
-               b += input[2*i];
-            a /= 10;
-            b /= 10;
-            d = fabsf(input[2*(n-1)] - input[0]);
-            if (trend = (d > fabs(a - input[0]) || d > fabs(b - input[2*(n-1)])))
-            {
-               a = input[0];
-               b = (input[2*(n-1)] - a)/n;
-               for (i = 0; i < n; i++)
-                  input[2*i] -= a + b*i;
-            }
+   #define FFT_FORWARD  FFTS_FORWARD
+   #define FFT_BACKWARD FFTS_BACKWARD
 
-            ffts_plan_t *p = ffts_init_1d(n, FFTS_FORWARD);
-            ffts_execute(p, input, output);
-            ffts_free(p);
+   typedef ffts_plan_t kernel_plan;
 
-            if (method == spectrum)
-            {
-               fprintf(outfile, "freq/%.4g/%s\t|At|/µhsp\n", timebase, timeunit);
-               int n2 = n >> 1;
-               for (i = 0; i <= n2; i++)
-                  fprintf(outfile, "%.12f\t%.9f\n", (double)i/n, sqrtf(sqrf(output[2*i]) + sqrf(output[2*i+1]))/n2);
-            }
+   #define kernelInit(n, sign)         ffts_init_1d(n, sign)
+   #define kernelExecute(p, in, out)   ffts_execute(p, in, out)
+   #define kernelFree(p)               ffts_free(p)
 
-            else if (method == filter)
-            {
-               // add the filter command line to the header of the output file
-               fprintf(outfile, "#");
-               for (i = 0; i < argc; i++)
-                  fprintf(outfile, " %s", argv[i]);
-               fprintf(outfile, "\n");
+   // FFTS does not execute all sizes in place, and in-place direct transforms go via a scratch copy
+   #define KERNEL_INPLACE false
 
-               bool invert;
-               if (invert = lowCut > highCut)
-                  d = lowCut, lowCut = highCut, highCut = d;
-               kT *= (highCut - lowCut)/100;
+#endif
 
-               int n2p1 = ((n & 0x1) ? (n + 1) >> 1 : n >> 1) + 1;
 
-               // positive frequencies
-               for (i = 0; i < n2p1; i++)
-               {
-                  float bf = blurfunc((float)i/(n - 1), lowCut, highCut, kT, invert);
-                  output[2*i    ] *= bf;
-                  output[2*i + 1] *= bf;
-               }
+// Four-Step FFT
 
-               // negative frequencies
-               for (i = n2p1; i < n; i++)
-               {
-                  float bf = blurfunc((float)(n - i)/(n - 1), lowCut, highCut, kT, invert);
-                  output[2*i    ] *= bf;
-                  output[2*i + 1] *= bf;
-               }
+// Transforms of up to LARGE_FFT points are handed over as a whole to the kernel. Larger ones
+// are factorized into n = n1·n2, and the data is viewed as a matrix of n1 rows by n2 columns:
+//  1. the n2 columns are transformed by n1 point FFTs, and multiplied by the twiddles W^(j2·k1)
+//  2. the n1 rows are transformed by n2 point FFTs, and written out transposed
+// The columns and rows are processed in blocks of FFT_BLOCK, which are gathered into per-thread
+// scratch memory, so that the memory is always accessed in runs of at least one cache line.
+//
+// In-place plans skip the final transposition, i.e. the forward transform leaves frequency k
+// at the position fftIndex(p, k), and the backward transform expects its input in this order.
+// It runs the passes in reverse order, rows first, then the twiddles, then the columns.
 
-               p = ffts_init_1d(n, FFTS_BACKWARD);
-               ffts_execute(p, output, input);
-               ffts_free(p);
+#define LARGE_FFT 262144
+#define FFT_BLOCK 16
 
-               fprintf(outfile, "%s\tAt/µhsp\n", timescale);
-               if (trend)
-                  for (i = 0; i < n; i++)
-                     fprintf(outfile, "%.9f\t%.9f\n", time[i], input[2*i]/n + a + b*i);
-               else
-                  for (i = 0; i < n; i++)
-                     fprintf(outfile, "%.9f\t%.9f\n", time[i], input[2*i]/n);
-            }
+typedef struct
+{
+   size_t n, n1, n2;
+   size_t stride;          // row length of the scratch blocks, in reals
+   int    sign, threads;
+   bool   inplace;
+   kernel_plan  *direct;   // the kernel for transforms up to LARGE_FFT points
+   kernel_plan **colPlans; // per thread kernels of length n1
+   kernel_plan **rowPlans; // per thread kernels of length n2
+   real        **scratch;  // per thread (FFT_BLOCK + 1)·stride reals, or 2n reals for in-place direct FFTS transforms
+   real   *in, *out;
+   void   *next;           // link in the plan cache
+} fft_plan;
+
+fft_plan *fftInit(size_t n, int sign, int threads, bool inplace)
+{
+   fft_plan *p = calloc(1, sizeof(fft_plan));
+   p->n = n;
+   p->sign = sign;
+   p->threads = (threads < 1) ? 1 : threads;
+   p->inplace = inplace;
+
+   // the factor nearest to the square root, which does not become too small
+   size_t n1 = 0;
+   if (n > LARGE_FFT)
+      for (n1 = (size_t)sqrt((double)n); n1 >= 64 && n % n1; n1--);
+
+   if (n1 < 64)
+   {
+      p->direct = kernelInit(n, sign);
+      if (inplace && !KERNEL_INPLACE)
+      {
+         p->scratch = malloc(sizeof(real *));
+         posix_memalign((void **)&p->scratch[0], 32, 2*n*sizeof(real));
+      }
+   }
+
+   else
+   {
+      p->n1 = n1;
+      p->n2 = n/n1;
+      p->stride = ((((n1 > p->n2) ? n1 : p->n2) + 3) & ~(size_t)3) << 1;
+      p->colPlans = malloc(p->threads*sizeof(kernel_plan *));
+      p->rowPlans = malloc(p->threads*sizeof(kernel_plan *));
+      p->scratch  = malloc(p->threads*sizeof(real *));
+      for (int t = 0; t < p->threads; t++)
+      {
+         p->colPlans[t] = kernelInit(p->n1, sign);
+         p->rowPlans[t] = kernelInit(p->n2, sign);
+         posix_memalign((void **)&p->scratch[t], 32, (FFT_BLOCK + 1)*p->stride*sizeof(real));
+      }
+   }
+
+   return p;
+}
+
+void fftFree(fft_plan *p)
+{
+   if (p)
+   {
+      if (p->direct)
+      {
+         kernelFree(p->direct);
+         if (p->scratch)
+            free(p->scratch[0]);
+      }
 
-            free(output);
-            free(input);
-            free(time);
+      else
+         for (int t = 0; t < p->threads; t++)
+         {
+            kernelFree(p->colPlans[t]);
+            kernelFree(p->rowPlans[t]);
+            free(p->scratch[t]);
          }
 
-         else
+      free(p->scratch);
+      free(p->rowPlans);
+      free(p->colPlans);
+      free(p);
+   }
+}
+
+// the position of frequency k in the output of the forward transform
+static inline size_t fftIndex(fft_plan *p, size_t k)
+{
+   return (p->inplace && !p->direct) ? (k % p->n1)*p->n2 + k/p->n1 : k;
+}
+
+// dst = src·W^(col·k1), k1 = 0 .. n1-1, by a recurrence which is resynchronized every 64 steps
+static void twiddle(fft_plan *p, size_t col, const real *src, real *dst)
+{
+   double phi = p->sign*2*M_PI/p->n,
+          sr  = cos(phi*col), si = sin(phi*col),
+          wr  = 1, wi = 0, re;
+
+   for (size_t k1 = 0; k1 < p->n1; k1++)
+   {
+      if ((k1 & 63) == 0)
+      {
+         re = phi*(double)(col*k1 % p->n);
+         wr = cos(re), wi = sin(re);
+      }
+
+      re = src[2*k1]*wr - src[2*k1 + 1]*wi;
+      dst[2*k1 + 1] = src[2*k1]*wi + src[2*k1 + 1]*wr;
+      dst[2*k1] = re;
+      re = wr*sr - wi*si;
+      wi = wr*si + wi*sr;
+      wr = re;
+   }
+}
+
+static void columnPass(void *context, size_t block, int thread)
+{
+   fft_plan *p = context;
+   size_t    n1 = p->n1, n2 = p->n2, stride = p->stride;
+   size_t    b, j1, j2 = block*FFT_BLOCK, bw = (n2 - j2 < FFT_BLOCK) ? n2 - j2 : FFT_BLOCK;
+   real     *buf = p->scratch[thread], *tmp = buf + FFT_BLOCK*stride, *x;
+
+   for (j1 = 0; j1 < n1; j1++)
+      for (x = p->in + 2*(j1*n2 + j2), b = 0; b < bw; b++)
+      {
+         buf[b*stride + 2*j1]     = x[2*b];
+         buf[b*stride + 2*j1 + 1] = x[2*b + 1];
+      }
+
+   for (b = 0; b < bw; b++)
+      if (p->inplace && p->sign == FFT_BACKWARD)
+      {
+         twiddle(p, j2 + b, buf + b*stride, tmp);
+         kernelExecute(p->colPlans[thread], tmp, buf + b*stride);
+      }
+      else
+      {
+         kernelExecute(p->colPlans[thread], buf + b*stride, tmp);
+         twiddle(p, j2 + b, tmp, buf + b*stride);
+      }
+
+   for (j1 = 0; j1 < n1; j1++)
+      for (x = p->in + 2*(j1*n2 + j2), b = 0; b < bw; b++)
+      {
+         x[2*b]     = buf[b*stride + 2*j1];
+         x[2*b + 1] = buf[b*stride + 2*j1 + 1];
+      }
+}
+
+static void rowPass(void *context, size_t block, int thread)
+{
+   fft_plan *p = context;
+   size_t    n1 = p->n1, n2 = p->n2, stride = p->stride;
+   size_t    b, k2, k1 = block*FFT_BLOCK, bh = (n1 - k1 < FFT_BLOCK) ? n1 - k1 : FFT_BLOCK;
+   real     *buf = p->scratch[thread], *tmp = buf + FFT_BLOCK*stride, *x;
+
+   for (b = 0; b < bh; b++)
+   {
+      memcpy(tmp, p->in + 2*(k1 + b)*n2, 2*n2*sizeof(real));
+      kernelExecute(p->rowPlans[thread], tmp, buf + b*stride);
+      if (p->inplace)
+         memcpy(p->in + 2*(k1 + b)*n2, buf + b*stride, 2*n2*sizeof(real));
+   }
+
+   if (!p->inplace)
+      for (k2 = 0; k2 < n2; k2++)
+         for (x = p->out + 2*(k2*n1 + k1), b = 0; b < bh; b++)
          {
-            printf("Invalid number of Points\n");
-            rc = usage();
+            x[2*b]     = buf[b*stride + 2*k2];
+            x[2*b + 1] = buf[b*stride + 2*k2 + 1];
+         }
+}
+
+// Transform n complex values from in to out. Both buffers must be 32 byte aligned.
+// Large transforms use in as scratch memory, and so its content is lost.
+// In-place plans must be given the same buffer for in and out.
+void fftExecute(fft_plan *p, real *in, real *out)
+{
+   size_t cols = (p->n2 + FFT_BLOCK - 1)/FFT_BLOCK,
+          rows = (p->n1 + FFT_BLOCK - 1)/FFT_BLOCK;
+
+   p->in  = in;
+   p->out = out;
+
+   if (p->direct)
+      if (p->inplace && !KERNEL_INPLACE)
+      {
+         memcpy(p->scratch[0], in, 2*p->n*sizeof(real));
+         kernelExecute(p->direct, p->scratch[0], out);
+      }
+      else
+         kernelExecute(p->direct, in, out);
+
+   else if (p->inplace && p->sign == FFT_BACKWARD)
+   {
+      parallelLoop(p->threads, rows, rowPass, p);
+      parallelLoop(p->threads, cols, columnPass, p);
+   }
+
+   else
+   {
+      parallelLoop(p->threads, cols, columnPass, p);
+      parallelLoop(p->threads, rows, rowPass, p);
+   }
+}
+
+
+// FFT Plan Cache
+
+// Plans which are not in use are kept in the cache, and they may be checked out by any thread.
+// A plan which has been checked out is used exclusively by the respective thread, until it is
+// checked in again. The cache is kept in the order of the last check-in, and it is cut back to
+// the MAX_PLANS most recently used plans, so that long running processes, which transform
+// series of many different lengths, don't pile up plans.
+
+#define MAX_PLANS 64
+
+static pthread_mutex_t planLock  = PTHREAD_MUTEX_INITIALIZER;
+static fft_plan       *planCache = NULL;
+
+fft_plan *planCheckout(size_t n, int sign, int threads, bool inplace)
+{
+   fft_plan *p, **link;
+
+   pthread_mutex_lock(&planLock);
+   for (link = &planCache; p = *link; link = (fft_plan **)&p->next)
+      if (p->n == n && p->sign == sign && p->threads == threads && p->inplace == inplace)
+      {
+         *link = p->next;
+         break;
+      }
+   pthread_mutex_unlock(&planLock);
+
+   return (p) ? p : fftInit(n, sign, threads, inplace);
+}
+
+void planCheckin(fft_plan *p)
+{
+   fft_plan **link, *stale;
+   int        k;
+
+   pthread_mutex_lock(&planLock);
+   p->next = planCache;
+   planCache = p;
+   for (link = &planCache, k = 0; *link && k < MAX_PLANS; link = (fft_plan **)&(*link)->next, k++);
+   stale = *link;
+   *link = NULL;
+   pthread_mutex_unlock(&planLock);
+
+   while (p = stale)
+   {
+      stale = p->next;
+      fftFree(p);
+   }
+}
+
+void planCacheFlush(void)
+{
+   fft_plan *p;
+
+   pthread_mutex_lock(&planLock);
+   while (p = planCache)
+   {
+      planCache = p->next;
+      fftFree(p);
+   }
+   pthread_mutex_unlock(&planLock);
+}
+
+
+// Time Axis
+
+// The time column is either regenerated from the first time point and the time base, in case
+// the points are equidistant in the unit of the time scale, or in case the time scale is
+// in decimal years of the calendar ('t/a') while the time unit is days ('d') - see sarconv.
+// Otherwise, the time points are stored in double precision.
+
+enum { timeStored, timeLinear, timeCalendar };
+
+typedef struct
+{
+   int     model;
+   double  t0, base;   // first time point and time base
+   double  day0;       // calendar: day number of the first time point, counted from 0001-01-01
+   double *t;          // stored time points
+} time_axis;
+
+static inline bool isLeapYear(long year)
+{
+   return (year % 4)
+          ? false
+          : (year % 100)
+            ? true
+            : (year % 400)
+              ? false
+              : true;
+}
+
+// day number of January 1st of the given year, counted from 0001-01-01
+static inline double yearStart(long y)
+{
+   y--;
+   return 365.0*y + y/4 - y/100 + y/400;
+}
+
+// set up the axis model from the time scale and time unit designators, e.g. 't/a' and 'd'
+void timeAxisInit(time_axis *ax, const char *timescale, const char *timeunit, double timebase)
+{
+   const char *u = strchr(timescale, '/');
+   u = (u) ? u + 1 : "";
+
+   *ax = (time_axis){timeStored, 0, timebase, 0, NULL};
+   if (strcmp(u, timeunit) == 0)
+      ax->model = timeLinear;
+   else if (strcmp(u, "a") == 0 && strcmp(timeunit, "d") == 0)
+      ax->model = timeCalendar;
+}
+
+double timeAt(time_axis *ax, size_t i)
+{
+   switch (ax->model)
+   {
+      default:
+         return ax->t[i];
+
+      case timeLinear:
+         return ax->t0 + i*ax->base;
+
+      case timeCalendar:
+      {
+         double d = ax->day0 + i*ax->base;
+         long   y = (long)(d/365.2425) + 1;
+         while (yearStart(y) > d)
+            y--;
+         while (yearStart(y + 1) <= d)
+            y++;
+         return y + (d - yearStart(y))/((isLeapYear(y)) ? 366 : 365);
+      }
+   }
+}
+
+// Record the time point t of sample i of n. Once a time point deviates by more than 1/1000 of
+// the spacing from the model, the axis falls back to storing all points in double precision.
+void timeAxisPut(time_axis *ax, size_t i, size_t n, double t)
+{
+   if (ax->model != timeStored && i == 0)
+   {
+      ax->t0 = t;
+      if (ax->model == timeCalendar)
+      {
+         // snap the day offset to half the time base, e.g. to the middle of the day
+         long   y = (long)floor(t);
+         double o = (t - y)*((isLeapYear(y)) ? 366 : 365),
+                h = ax->base/2;
+         if (fabs(o - h*round(o/h)) < 1e-3*ax->base)
+            o = h*round(o/h);
+         ax->day0 = yearStart(y) + o;
+      }
+   }
+
+   else if (ax->model != timeStored && fabs(t - timeAt(ax, i)) > 1e-3*fabs(timeAt(ax, 1) - timeAt(ax, 0)))
+   {
+      double *tp = malloc(n*sizeof(double));
+      for (size_t k = 0; k < i; k++)
+         tp[k] = timeAt(ax, k);
+      ax->model = timeStored;
+      ax->t = tp;
+   }
+
+   if (ax->model == timeStored)
+   {
+      if (!ax->t)
+         ax->t = malloc(n*sizeof(double));
+      ax->t[i] = t;
+   }
+}
+
+
+// Spectrum Cache
+
+// The cache file contains the header, the forward spectrum in the order of the forward plan
+// starting at CACHE_DATA, and the time points in double precision in case the time axis is
+// stored. The key is the FNV-1a hash of the whole input file, the number of points, the size
+// of the reals, and the order of the spectrum, given by the position of frequency 1.
+// On a hit, the file is mapped copy-on-write, so that the spectrum can be masked in place.
+
+#define CACHE_DATA 128
+
+typedef struct
+{
+   char     magic[8];
+   uint64_t hash, n;
+   uint32_t realSize, order;
+   uint32_t trend, model;
+   double   a, b, variance;
+   double   t0, day0;
+} cache_header;
+
+// the hash of the whole file, the file position is restored, and 0 is returned for non-seekable streams
+uint64_t hashStream(FILE *file)
+{
+   long     pos = ftell(file);
+   uint64_t hash = 0xCBF29CE484222325;
+   size_t   i, k;
+   unsigned char chunk[65536];
+
+   if (pos < 0 || fseek(file, 0, SEEK_SET) != 0)
+      return 0;
+
+   while ((k = fread(chunk, 1, sizeof(chunk), file)) > 0)
+      for (i = 0; i < k; i++)
+         hash = (hash ^ chunk[i])*0x100000001B3;
+
+   fseek(file, pos, SEEK_SET);
+   return (hash) ? hash : 1;
+}
+
+// in case the given cache path is a directory, the file name is made from the hash, the number of points,
+// the order of the spectrum and the size of the reals, so that in-place and ordered spectra of single and
+// double precision builds don't evict each other
+char *cachePath(const char *cache, uint64_t hash, size_t n, uint32_t order)
+{
+   struct stat st;
+   char *path;
+
+   if (stat(cache, &st) == 0 && S_ISDIR(st.st_mode))
+   {
+      size_t len = strlen(cache) + 80;
+      snprintf(path = malloc(len), len, "%s/%016llx-%zu-%u-%zu.spectrum", cache, (unsigned long long)hash, n, order, sizeof(real));
+   }
+   else
+      path = strdup(cache);
+
+   return path;
+}
+
+cache_header *cacheLoad(const char *path, uint64_t hash, size_t n, uint32_t order, size_t *size)
+{
+   int           fd;
+   struct stat   st;
+   cache_header *h = NULL;
+
+   if ((fd = open(path, O_RDONLY)) >= 0)
+   {
+      if (fstat(fd, &st) == 0 && st.st_size >= CACHE_DATA + 2*n*sizeof(real)
+       && (h = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0)) != MAP_FAILED)
+      {
+         if (memcmp(h->magic, "cyclasar", 8) != 0 || h->hash != hash || h->n != n
+          || h->realSize != sizeof(real) || h->order != order
+          || h->model == timeStored && st.st_size < CACHE_DATA + 2*n*sizeof(real) + n*sizeof(double))
+         {
+            munmap(h, st.st_size);
+            h = NULL;
+         }
+         else
+            *size = st.st_size;
+      }
+
+      else
+         h = NULL;
+
+      close(fd);
+   }
+
+   return h;
+}
+
+// write the cache file under a temporary name, and rename it when complete
+void cacheStore(const char *path, cache_header *h, const real *spectrum, const double *times)
+{
+   FILE *file;
+   size_t len = strlen(path) + 16;
+   char  *temp = malloc(len);
+   char   pad[CACHE_DATA] = {0};
+
+   snprintf(temp, len, "%s.%d", path, (int)getpid());
+   if (file = fopen(temp, "w"))
+   {
+      bool ok = fwrite(h, sizeof(cache_header), 1, file) == 1
+             && fwrite(pad, CACHE_DATA - sizeof(cache_header), 1, file) == 1
+             && fwrite(spectrum, 2*sizeof(real), h->n, file) == h->n
+             && (h->model != timeStored || fwrite(times, sizeof(double), h->n, file) == h->n);
+
+      if (fclose(file) == 0 && ok)
+         rename(temp, path);
+      else
+         unlink(temp);
+   }
+
+   free(temp);
+}
+
+
+// Spectral Analysis
+
+static inline double sqrr(real x)
+{
+   return x*x;
+}
+
+float blurfunc(float f, float lowCut, float highCut, float kT, bool invert)
+{
+   float result;
+
+   if (lowCut == highCut)
+      return 0;
+
+   if (0 < kT && kT <= 100)
+      if (lowCut == 0)
+         result = 1/(1 + expf((f - highCut)/kT));
+      else
+         result = 1/(1 + expf((f - highCut)/kT))/(1 + expf((lowCut - f)/kT));
+
+   else if (lowCut <= f && (f <= highCut || isinf(highCut)))
+      result = 1;
+
+   else
+      result = 0;
+
+   return (invert) ? 1 - result : result;
+}
+
+void writeCommandLine(FILE *outfile, int argc, const char *argv[])
+{
+   fprintf(outfile, "#");
+   for (int i = 0; i < argc; i++)
+      fprintf(outfile, " %s", argv[i]);
+   fprintf(outfile, "\n");
+}
+
+
+// Series
+
+typedef struct
+{
+   size_t    n;
+   double    timebase;
+   char      timeunit[32], timescale[64];
+   time_axis time;
+   bool      trend;
+   double    a, b;        // trend line a + b·i
+   double    variance;    // of the detrended series
+} series;
+
+// Read the header lines, and pass them through to echo, if given. The time base and the point
+// count of the echo refer to every step-th point of the series. Tell whether there are enough
+// points to work with.
+bool readHeader(FILE *infile, FILE *echo, size_t step, series *s)
+{
+   int   i;
+   char *line, buf[256];
+   bool  based = false;
+
+   *s = (series){65536, 1, "d", "t/a"};
+   while ((line = fgets(buf, 256, infile)) && *line == '#')
+   {
+      if (echo)
+         if (step > 1 && strstr(line, "# Time base:   "))
+            fprintf(echo, "# Time base:   %.9g\n", strtod(line+15, NULL)*step);
+         else if (step > 1 && strstr(line, "# Point count: "))
+            fprintf(echo, "# Point count: %ld\n", (strtol(line+15, NULL, 10) + (long)step - 1)/(long)step);
+         else
+            fprintf(echo, "%s", line);
+
+      if (strstr(line, "# Time base:   "))
+      {
+         s->timebase = strtod(line+15, NULL);
+         based = true;
+      }
+
+      if (strstr(line, "# Time unit:   "))
+      {
+         for (line += 15, i = 0; i < sizeof(s->timeunit) - 1 && (unsigned char)line[i] >= ' '; i++)
+            s->timeunit[i] = line[i];
+         s->timeunit[i] = '\0';
+      }
+
+      if (strstr(line, "# Point count: "))
+      {
+         long n = strtol(line+15, NULL, 10);
+         s->n = (n > 0) ? n : 0;
+      }
+   }
+
+   if (echo && step > 1 && !based)
+      fprintf(echo, "# Time base:   %zu\n", step);
+
+   if (!line || s->n <= 2 || (s->n + step - 1)/step <= 2)
+      return false;
+
+   // the line with the column titles has just been read in, and will be implicitely skiped
+
+   // skip whitespace and non-printing chars
+   while ((unsigned char)*line && (unsigned char)*line <= ' ')
+      line++;
+   if (*line < '0' || '9' < *line)
+   {
+      for (i = 0; i < sizeof(s->timescale) - 1 && (unsigned char)line[i] > ' '; i++)
+         s->timescale[i] = line[i];
+      s->timescale[i] = '\0';
+   }
+
+   timeAxisInit(&s->time, s->timescale, s->timeunit, s->timebase);
+   return true;
+}
+
+// Read the n points of the series into the real parts of input, and remove the trend,
+// if any. Tell whether all the points could be read.
+bool readData(FILE *infile, series *s, real *input)
+{
+   size_t i, n = s->n;
+   char  *line, buf[256];
+
+   for (i = 0; i < n; i++)
+   {
+      if (!(line = fgets(buf, 256, infile)))
+         return false;
+
+      timeAxisPut(&s->time, i, n, strtod(line, &line));     // first column is the time - simply pass through
+      input[2*i    ] = strtor(line, &line);                 // second column is the daily total active area of the sun
+      input[2*i + 1] = 0;
+   }
+
+   // trend correction
+   double a = 0, b = 0, d;
+   for (i = 0; i < 10; i++)
+      a += input[2*i];
+   for (i = n-10; i < n; i++)
+      b += input[2*i];
+   a /= 10;
+   b /= 10;
+   d = fabs(input[2*(n-1)] - input[0]);
+   if (s->trend = (d > fabs(a - input[0]) || d > fabs(b - input[2*(n-1)])))
+   {
+      s->a = a = input[0];
+      s->b = b = (input[2*(n-1)] - a)/n;
+      for (i = 0; i < n; i++)
+         input[2*i] -= a + b*i;
+   }
+
+   double mean = 0;
+   for (i = 0; i < n; i++)
+      mean += input[2*i];
+   s->variance = 0;
+   for (mean /= n, i = 0; i < n; i++)
+      s->variance += sqrr(input[2*i] - mean);
+   s->variance /= n;
+
+   return true;
+}
+
+// The spectrum is in the order of the forward plan p, a NULL plan stands for the natural order.
+void writeSpectrum(FILE *outfile, series *s, fft_plan *p, const real *spectrum)
+{
+   size_t i, n = s->n, n2 = n >> 1;
+
+   fprintf(outfile, "freq/%.4g/%s\t|At|/µhsp\n", s->timebase, s->timeunit);
+   for (i = 0; i <= n2; i++)
+   {
+      const real *X = spectrum + 2*((p) ? fftIndex(p, i) : i);
+      fprintf(outfile, "%.12f\t%.9f\n", (double)i/n, (real)sqrt(sqrr(X[0]) + sqrr(X[1]))/n2);
+   }
+}
+
+// Parse the low cut, the high cut and the blur of the filter, and tell whether they are valid.
+bool parseCuts(const char *argv[], float *lowCut, float *highCut, float *kT)
+{
+   *lowCut  = strtof(argv[0], NULL);
+   *highCut = strtof(argv[1], NULL);
+   *kT      = strtof(argv[2], NULL);
+
+   return *lowCut >= 0 && *highCut >= 0 && 0 <= *kT && *kT <= 100;
+}
+
+void maskSpectrum(series *s, fft_plan *p, real *spectrum, float lowCut, float highCut, float kT)
+{
+   size_t i, n = s->n;
+
+   bool invert;
+   if (invert = lowCut > highCut)
+   {
+      float d = lowCut;
+      lowCut  = highCut;
+      highCut = d;
+   }
+   kT *= (highCut - lowCut)/100;
+
+   size_t n2p1 = ((n & 0x1) ? (n + 1) >> 1 : n >> 1) + 1;
+
+   // positive frequencies
+   for (i = 0; i < n2p1; i++)
+   {
+      float bf = blurfunc((float)i/(n - 1), lowCut, highCut, kT, invert);
+      real *X = spectrum + 2*((p) ? fftIndex(p, i) : i);
+      X[0] *= bf;
+      X[1] *= bf;
+   }
+
+   // negative frequencies
+   for (i = n2p1; i < n; i++)
+   {
+      float bf = blurfunc((float)(n - i)/(n - 1), lowCut, highCut, kT, invert);
+      real *X = spectrum + 2*((p) ? fftIndex(p, i) : i);
+      X[0] *= bf;
+      X[1] *= bf;
+   }
+}
+
+// Fold the spectrum of the n points onto the m = n/step frequencies of the decimated series,
+// and store it in the order of the backward plan q of m points. Every step-th point of the
+// backward transform of n points equals the backward transform of m points of the folded
+// spectrum, and so the decimated series comes at the cost of the smaller transform. This
+// works only if step is a divisor of n.
+void foldSpectrum(series *s, fft_plan *p, const real *spectrum, size_t step, fft_plan *q, real *folded)
+{
+   size_t i, j, n = s->n, m = n/step;
+
+   for (i = 0; i < m; i++)
+   {
+      double re = 0, im = 0;
+      for (j = i; j < n; j += m)
+      {
+         const real *X = spectrum + 2*((p) ? fftIndex(p, j) : j);
+         re += X[0];
+         im += X[1];
+      }
+      folded[2*fftIndex(q, i)]     = re;
+      folded[2*fftIndex(q, i) + 1] = im;
+   }
+}
+
+// write out every step-th point of the backward transform of the masked spectrum, which is given
+// in x, in case of decimation already compacted to ⌈n/step⌉ points, and restore the trend
+void writeFiltered(FILE *outfile, series *s, const real *x, size_t step)
+{
+   size_t i, j, n = s->n;
+
+   fprintf(outfile, "%s\tAt/µhsp\n", s->timescale);
+   if (s->trend)
+      for (i = 0, j = 0; i < n; i += step, j++)
+         fprintf(outfile, "%.9f\t%.9f\n", timeAt(&s->time, i), x[2*j]/n + s->a + s->b*i);
+   else
+      for (i = 0, j = 0; i < n; i += step, j++)
+         fprintf(outfile, "%.9f\t%.9f\n", timeAt(&s->time, i), x[2*j]/n);
+}
+
+
+
+// Time Domain Smoothing
+
+// The smoothers stream the series line by line through windows of the given width, and their
+// cost per point does not depend on the width. The moving average keeps a running sum, the boxcar
+// cascades BOXCAR_PASSES moving averages, the exponential smoother is recursive, and the quadratic
+// Savitzky-Golay smoother keeps the running moments Σx, Σjx and Σj²x about the window center.
+// The running sums are recomputed from the window every width points, so that they cannot drift.
+// All data columns of a line are updated in lockstep.
+
+#define MAX_COLUMNS   32
+#define BOXCAR_PASSES 3
+
+enum { smoothMean, smoothBoxcar, smoothExp, smoothSG };
+
+typedef struct
+{
+   int     width, cols, pos, count;
+   double *ring;           // width·cols points, the column index running fastest
+   double *s0, *s1, *s2;   // per column Σx, Σjx and Σj²x, with j relative to the window center
+} window;
+
+window *windowInit(int width, int cols)
+{
+   window *w = calloc(1, sizeof(window));
+   w->width = width;
+   w->cols  = cols;
+   w->ring  = calloc(width*cols, sizeof(double));
+   w->s0    = calloc(3*cols, sizeof(double));
+   w->s1    = w->s0 + cols;
+   w->s2    = w->s1 + cols;
+   return w;
+}
+
+void windowFree(window *w)
+{
+   if (w)
+   {
+      free(w->s0);
+      free(w->ring);
+      free(w);
+   }
+}
+
+// Push one point per column into the window, and tell whether the window is filled.
+bool windowPush(window *w, const double *x)
+{
+   int     c, k, cols = w->cols;
+   double  h = (w->width - 1)/2.0, j, *slot = w->ring + w->pos*cols;
+
+   // drop the oldest point at j = -h, shift j -> j-1, and add the newest point at j = +h
+   for (c = 0; c < cols; c++)
+   {
+      double out = slot[c];
+      w->s0[c] -= out;
+      w->s1[c] += h*out;
+      w->s2[c] -= h*h*out;
+      w->s2[c] += w->s0[c] - 2*w->s1[c];
+      w->s1[c] -= w->s0[c];
+      w->s0[c] += x[c];
+      w->s1[c] += h*x[c];
+      w->s2[c] += h*h*x[c];
+      slot[c] = x[c];
+   }
+
+   if (++w->pos == w->width)
+   {
+      w->pos = 0;
+
+      // resynchronize the running sums, the oldest point is at pos = 0
+      if (w->count == w->width)
+      {
+         memset(w->s0, 0, 3*cols*sizeof(double));
+         for (k = 0, j = -h; k < w->width; k++, j++)
+            for (slot = w->ring + k*cols, c = 0; c < cols; c++)
+            {
+               w->s0[c] += slot[c];
+               w->s1[c] += j*slot[c];
+               w->s2[c] += j*j*slot[c];
+            }
+      }
+   }
+
+   if (w->count < w->width)
+      w->count++;
+
+   return w->count == w->width;
+}
+
+static inline int smoothSpan(int kind, int width)
+{
+   return (kind == smoothExp)
+          ? 1
+          : (kind == smoothBoxcar)
+            ? BOXCAR_PASSES*(width - 1) + 1
+            : width;
+}
+
+// Smooth all data columns of the infile. Each output point is time stamped with the middle
+// of the time span of the input points which contribute to it, and so the series becomes
+// shorter by the span minus one point, except for the causal exponential smoother. The first
+// data row defines the number of columns, which is limited to MAX_COLUMNS, and the smoothing
+// stops with an error at a row with fewer columns. Blank lines are skipped.
+int smoothSeries(FILE *infile, FILE *outfile, int kind, int width, int argc, const char *argv[])
+{
+   int    c, i, cols = 0, pass, rc = 0, lineno = 0, span = smoothSpan(kind, width);
+   char  *line, *p, buf[1024];
+
+   while ((line = fgets(buf, 1024, infile)) && ++lineno && *line == '#')
+      if (strstr(line, "# Point count: "))
+      {
+         int n = (int)strtol(line+15, NULL, 10);
+         fprintf(outfile, "# Point count: %d\n", (n >= span) ? n - span + 1 : 0);
+      }
+      else
+         fprintf(outfile, "%s", line);
+
+   // add the smooth command line to the header of the output file
+   writeCommandLine(outfile, argc, argv);
+
+   // pass through the line with the column titles
+   if (line && (*line < '0' || '9' < *line) && *line != '-')
+   {
+      fprintf(outfile, "%s", line);
+      line = fgets(buf, 1024, infile);
+      lineno++;
+   }
+
+   double  t, x[MAX_COLUMNS], y[MAX_COLUMNS];
+   double *times = malloc(span*sizeof(double));
+   window *stages[BOXCAR_PASSES] = {NULL};
+
+   double h = (width - 1)/2.0,
+          alpha = 2.0/(width + 1),
+          sgNorm = (2*h + 1)*(4*h*h + 4*h - 3),
+          sg0 = 3*(3*h*h + 3*h - 1)/sgNorm,
+          sg2 = 15/sgNorm;
+
+   for (i = 0; line; line = fgets(buf, 1024, infile), lineno++)
+   {
+      for (p = line; *p == ' ' || *p == '\t' || *p == '\r'; p++);
+      if (*p == '\n' || *p == '\0')
+         continue;
+
+      t = strtod(line, &line);
+      if (cols == 0)
+      {
+         for (p = line; cols <= MAX_COLUMNS && (x[cols % MAX_COLUMNS] = strtod(p, &line), line != p); p = line)
+            cols++;
+         if (cols == 0)
+            break;
+
+         if (cols > MAX_COLUMNS)
+         {
+            fprintf(stderr, "Line %d has more than %d data columns.\n", lineno, MAX_COLUMNS);
+            rc = 1;
+            break;
+         }
+
+         for (pass = 0; pass < ((kind == smoothBoxcar) ? BOXCAR_PASSES : (kind == smoothExp) ? 0 : 1); pass++)
+            stages[pass] = windowInit(width, cols);
+      }
+      else
+      {
+         for (c = 0, p = line; c < cols && (x[c] = strtod(p, &line), line != p); c++, p = line);
+         if (c < cols)
+         {
+            fprintf(stderr, "Line %d has fewer than %d data columns.\n", lineno, cols);
+            rc = 1;
+            break;
+         }
+      }
+
+      times[i % span] = t;
+
+      bool valid = false;
+      switch (kind)
+      {
+         case smoothMean:
+            if (valid = windowPush(stages[0], x))
+               for (c = 0; c < cols; c++)
+                  y[c] = stages[0]->s0[c]/width;
+            break;
+
+         case smoothBoxcar:
+            for (valid = true, pass = 0; valid && pass < BOXCAR_PASSES; pass++)
+               if (valid = windowPush(stages[pass], (pass == 0) ? x : y))
+                  for (c = 0; c < cols; c++)
+                     y[c] = stages[pass]->s0[c]/width;
+            break;
+
+         case smoothExp:
+            for (c = 0; c < cols; c++)
+               y[c] = (i == 0) ? x[c] : y[c] + alpha*(x[c] - y[c]);
+            valid = true;
+            break;
+
+         case smoothSG:
+            if (valid = windowPush(stages[0], x))
+               for (c = 0; c < cols; c++)
+                  y[c] = sg0*stages[0]->s0[c] - sg2*stages[0]->s2[c];
+            break;
+      }
+
+      if (valid)
+      {
+         fprintf(outfile, "%.9f", (times[(i + 1) % span] + t)/2);
+         for (c = 0; c < cols; c++)
+            fprintf(outfile, "\t%.9f", y[c]);
+         fprintf(outfile, "\n");
+      }
+
+      i++;
+   }
+
+   for (pass = 0; pass < BOXCAR_PASSES; pass++)
+      windowFree(stages[pass]);
+   free(times);
+
+   return rc;
+}
+
+
+// Continuous Wavelet Transform
+
+// The wavelet transform of Torrence and Compo (1998), which is computed for each scale s by
+// multiplying the spectrum of the series with the Fourier transformed daughter wavelet ψ(s·ω),
+// and by transforming the product back into the time domain. The scales are distributed over
+// the threads, which check out single threaded inverse plans from the plan cache. Each row of
+// the scalogram is written out as soon as all of its preceding rows have been written.
+
+enum { morlet, paul };
+
+typedef struct
+{
+   int       mother, scales;
+   double    param, dj, dt, s0, variance;
+   size_t    n;
+   fft_plan *forward;         // the plan which transformed the series, defines the order of the spectrum
+   real     *spectrum;
+   real    **buffers;         // per thread 2n reals
+   FILE     *outfile;
+   size_t    nextRow;
+   pthread_mutex_t lock;
+   pthread_cond_t  turn;
+} wavelet_job;
+
+// the Fourier transformed mother wavelet at the scaled angular frequency sw
+static double motherWavelet(int mother, double param, double sw)
+{
+   if (sw <= 0)
+      return 0;
+
+   else if (mother == morlet)
+      return exp(-(sw - param)*(sw - param)/2)/pow(M_PI, 0.25);
+
+   else
+      return exp(param*M_LN2 - (log(param) + lgamma(2*param))/2 + param*log(sw) - sw);
+}
+
+// the ratio of the Fourier period to the scale, and the e-folding time of the wavelet power
+// at an edge in units of the scale
+static void waveletFactors(int mother, double param, double *fourierFactor, double *efold)
+{
+   if (mother == morlet)
+   {
+      *fourierFactor = 4*M_PI/(param + sqrt(2 + param*param));
+      *efold = M_SQRT2;
+   }
+
+   else
+   {
+      *fourierFactor = 4*M_PI/(2*param + 1);
+      *efold = M_SQRT1_2;
+   }
+}
+
+static void waveletRow(void *context, size_t row, int thread)
+{
+   wavelet_job *w = context;
+   size_t    k, n = w->n;
+   double    s = w->s0*exp2(row*w->dj),
+             norm = sqrt(2*M_PI*s/w->dt)/n,
+             ff, efold;
+   real     *X = w->buffers[thread], *S;
+   fft_plan *p = planCheckout(n, FFT_BACKWARD, 1, true);
+
+   for (k = 0; k < n; k++)
+   {
+      double omega = 2*M_PI*((k <= n/2) ? (double)k : -(double)(n - k))/(n*w->dt),
+             psi   = norm*motherWavelet(w->mother, w->param, s*omega);
+      S = w->spectrum + 2*fftIndex(w->forward, k);
+      X[2*fftIndex(p, k)]     = S[0]*psi;
+      X[2*fftIndex(p, k) + 1] = S[1]*psi;
+   }
+
+   fftExecute(p, X, X);
+   planCheckin(p);
+
+   waveletFactors(w->mother, w->param, &ff, &efold);
+
+   pthread_mutex_lock(&w->lock);
+   while (w->nextRow != row)
+      pthread_cond_wait(&w->turn, &w->lock);
+
+   fprintf(w->outfile, "%.9g", ff*s);
+   for (k = 0; k < n; k++)
+      fprintf(w->outfile, "\t%.6g", (sqrr(X[2*k]) + sqrr(X[2*k + 1]))/w->variance);
+   fprintf(w->outfile, "\n");
+
+   w->nextRow++;
+   pthread_cond_broadcast(&w->turn);
+   pthread_mutex_unlock(&w->lock);
+}
+
+// Write the scalogram of the spectrum, which has been transformed by the given forward plan:
+//  - the first row contains the time points
+//  - the second row contains the period at the edge of the cone of influence for each time point
+//  - each further row contains the period followed by the normalized wavelet power |W|²/σ²
+// The smallest scale is 2·dt, and the scales grow by 2^dj up to the length of the series.
+void waveletScalogram(FILE *outfile, int mother, double param, double dj, int threads,
+                      series *s, fft_plan *forward, real *spectrum)
+{
+   size_t i, n = s->n;
+   int    t;
+   double ff, efold;
+
+   wavelet_job w = {mother, 0, param, dj, s->timebase, 2*s->timebase, s->variance, n, forward, spectrum, NULL, outfile, 0,
+                    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+   w.scales = (int)floor(log2(n*w.dt/w.s0)/dj) + 1;
+
+   waveletFactors(mother, param, &ff, &efold);
+
+   fprintf(outfile, "# Scale count: %d\n", w.scales);
+   fprintf(outfile, "%s", s->timescale);
+   for (i = 0; i < n; i++)
+      fprintf(outfile, "\t%.9f", timeAt(&s->time, i));
+   fprintf(outfile, "\nCOI/%s", s->timeunit);
+   for (i = 0; i < n; i++)
+      fprintf(outfile, "\t%.9g", ff/efold*s->timebase*((i < n - 1 - i) ? i : n - 1 - i));
+   fprintf(outfile, "\n");
+
+   if (threads > w.scales)
+      threads = w.scales;
+   w.buffers = malloc(threads*sizeof(real *));
+   for (t = 0; t < threads; t++)
+      posix_memalign((void **)&w.buffers[t], 32, 2*n*sizeof(real));
+
+   parallelLoop(threads, w.scales, waveletRow, &w);
+
+   for (t = 0; t < threads; t++)
+      free(w.buffers[t]);
+   free(w.buffers);
+   planCacheFlush();
+}
+
+
+// Spectral Peaks
+
+// The strongest local maxima of the amplitude spectrum are located, and their frequencies are
+// refined by interpolation between the neighbouring bins, either by a parabola through the
+// amplitudes, or by Quinn's second estimator (1997) from the complex values. Then the sum of the
+// sinusoids a·cos(ωt) + b·sin(ωt) and a straight line is fitted to the series by Levenberg-Marquardt,
+// with the amplitudes, phases and frequencies of all peaks as joint parameters. The time t is
+// counted from the middle of the series, which decouples the phases from the frequencies. The
+// line takes up what the end point trend correction leaves over.
+// The residuals and the Jacobian are evaluated in blocks of PEAK_BLOCK points, within which the
+// sinusoids follow from the tables of cos(ωk) and sin(ωk) by the angle sum, so that the inner
+// loops run over contiguous arrays and vectorize. The blocks are split into one contiguous chunk
+// per thread, and the chunks sum their own normal equations, which are added up in order.
+
+#define PEAK_BLOCK     256
+#define MAX_PEAKS       64
+#define FIT_ITERATIONS 100
+#define FIT_TOLERANCE  1e-10      // relative decrease of the squared residuals at convergence
+
+enum { parabolic, quinn };
+
+typedef struct
+{
+   double freq;           // in cycles per sample
+   double a, b;           // cosine and sine amplitudes with respect to the middle of the series
+   double spectral;       // the interpolated frequency of the spectral maximum
+   double height;         // the spectral amplitude of the maximum
+} spectral_peak;
+
+typedef struct
+{
+   size_t        n, blocks, chunks;
+   int           count, params;     // params = 3·count + 2: the offset, the slope, and a, b, ω of each peak
+   double        center;
+   const real   *x;                 // the series in the real parts, scaled by 1/n
+   const double *theta, *rotation;  // the parameters, and count tables of cos(ωk) and sin(ωk)
+   bool          normal;            // sum the normal equations, or the squared residuals only
+   double      **sums;              // per chunk the normal matrix, the right side and the squared residuals
+   double      **columns;           // per chunk the residuals and the Jacobian of a block
+} fit_job;
+
+static inline double dotProduct(const double *restrict u, const double *restrict v, size_t m)
+{
+   double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+   size_t k;
+   for (k = 0; k + 4 <= m; k += 4)
+   {
+      s0 += u[k]*v[k];
+      s1 += u[k + 1]*v[k + 1];
+      s2 += u[k + 2]*v[k + 2];
+      s3 += u[k + 3]*v[k + 3];
+   }
+   for (; k < m; k++)
+      s0 += u[k]*v[k];
+   return (s0 + s1) + (s2 + s3);
+}
+
+static void fitChunk(void *context, size_t chunk, int thread)
+{
+   fit_job *f = context;
+   int      j, p, q, P = f->params;
+   size_t   k, block, m;
+   double  *sum = f->sums[chunk],
+           *r   = f->columns[chunk],
+           *J   = r + PEAK_BLOCK;
+
+   memset(sum, 0, (P*P + P + 1)*sizeof(double));
+
+   for (block = chunk*f->blocks/f->chunks; block < (chunk + 1)*f->blocks/f->chunks; block++)
+   {
+      size_t i0 = block*PEAK_BLOCK;
+      double t0 = i0 - f->center;
+      m = (f->n - i0 < PEAK_BLOCK) ? f->n - i0 : PEAK_BLOCK;
+
+      for (k = 0; k < m; k++)
+      {
+         r[k] = (double)f->x[2*(i0 + k)]/f->n - f->theta[0] - f->theta[1]*(t0 + k);
+         J[k] = 1;
+         J[PEAK_BLOCK + k] = t0 + k;
+      }
+
+      for (j = 0; j < f->count; j++)
+      {
+         const double *ck = f->rotation + 2*j*PEAK_BLOCK,
+                      *sk = ck + PEAK_BLOCK;
+         double a = f->theta[3*j + 2],
+                b = f->theta[3*j + 3],
+                w = f->theta[3*j + 4],
+                C = cos(w*t0),
+                S = sin(w*t0);
+         double *Ja = J + (3*j + 2)*PEAK_BLOCK,
+                *Jb = Ja + PEAK_BLOCK,
+                *Jw = Jb + PEAK_BLOCK;
+
+         if (f->normal)
+            for (k = 0; k < m; k++)
+            {
+               double c = C*ck[k] - S*sk[k],
+                      s = S*ck[k] + C*sk[k];
+               r[k] -= a*c + b*s;
+               Ja[k] = c;
+               Jb[k] = s;
+               Jw[k] = (t0 + k)*(b*c - a*s);
+            }
+
+         else
+            for (k = 0; k < m; k++)
+               r[k] -= a*(C*ck[k] - S*sk[k]) + b*(S*ck[k] + C*sk[k]);
+      }
+
+      sum[P*P + P] += dotProduct(r, r, m);
+      if (f->normal)
+         for (p = 0; p < P; p++)
+         {
+            sum[P*P + p] += dotProduct(J + p*PEAK_BLOCK, r, m);
+            for (q = 0; q <= p; q++)
+               sum[p*P + q] += dotProduct(J + p*PEAK_BLOCK, J + q*PEAK_BLOCK, m);
+         }
+   }
+}
+
+// Sum the squared residuals, and if normal is set, the normal equations N·δ = g of the given
+// parameters into sum, the lower triangle of N followed by g and the squared residuals.
+static double fitEvaluate(fit_job *f, const double *theta, bool normal, int threads, double *sum)
+{
+   int    j, c, P = f->params, S = P*P + P + 1;
+   size_t k;
+
+   double *rotation = malloc(2*f->count*PEAK_BLOCK*sizeof(double));
+   for (j = 0; j < f->count; j++)
+      for (k = 0; k < PEAK_BLOCK; k++)
+      {
+         rotation[2*j*PEAK_BLOCK + k]              = cos(theta[3*j + 4]*k);
+         rotation[2*j*PEAK_BLOCK + PEAK_BLOCK + k] = sin(theta[3*j + 4]*k);
+      }
+
+   f->theta    = theta;
+   f->rotation = rotation;
+   f->normal   = normal;
+   parallelLoop(threads, f->chunks, fitChunk, f);
+
+   memcpy(sum, f->sums[0], S*sizeof(double));
+   for (c = 1; c < f->chunks; c++)
+      for (j = 0; j < S; j++)
+         sum[j] += f->sums[c][j];
+
+   free(rotation);
+   return sum[P*P + P];
+}
+
+// Solve A·x = b in place of b by the Cholesky decomposition of the lower triangle of A,
+// and tell whether A is positive definite.
+static bool choleskySolve(double *A, double *b, int P)
+{
+   int i, j, k;
+
+   for (j = 0; j < P; j++)
+   {
+      double d = A[j*P + j];
+      for (k = 0; k < j; k++)
+         d -= A[j*P + k]*A[j*P + k];
+      if (!(d > 0))
+         return false;
+      A[j*P + j] = d = sqrt(d);
+
+      for (i = j + 1; i < P; i++)
+      {
+         double e = A[i*P + j];
+         for (k = 0; k < j; k++)
+            e -= A[i*P + k]*A[j*P + k];
+         A[i*P + j] = e/d;
+      }
+   }
+
+   for (i = 0; i < P; i++)
+   {
+      for (k = 0; k < i; k++)
+         b[i] -= A[i*P + k]*b[k];
+      b[i] /= A[i*P + i];
+   }
+
+   for (i = P - 1; i >= 0; i--)
+   {
+      for (k = i + 1; k < P; k++)
+         b[i] -= A[k*P + i]*b[k];
+      b[i] /= A[i*P + i];
+   }
+
+   return true;
+}
+
+static inline const real *spectralBin(fft_plan *p, const real *spectrum, size_t k)
+{
+   return spectrum + 2*fftIndex(p, k);
+}
+
+// the correction term of Quinn's second estimator
+static double quinnTau(double x)
+{
+   return log(3*x*x + 6*x + 1)/4 - sqrt(6)/24*log((x + 1 - sqrt(2.0/3.0))/(x + 1 + sqrt(2.0/3.0)));
+}
+
+// Find the count strongest local maxima of the spectrum, which has been transformed by the given
+// forward plan, and interpolate their frequencies. Return the number of peaks found, strongest first.
+// The search starts at bin 2, since one cycle per record is not a resolved period, and bin 1 mostly
+// carries the leakage of what the end point trend correction leaves over.
+int findPeaks(series *s, fft_plan *p, const real *spectrum, int count, int interpolation, spectral_peak *peaks)
+{
+   size_t i, n = s->n, n2 = n >> 1;
+   int    j, found = 0;
+
+   const real *X1 = spectralBin(p, spectrum, 1),
+              *X  = spectralBin(p, spectrum, 2);
+   double prev = sqrr(X1[0]) + sqrr(X1[1]), curr = sqrr(X[0]) + sqrr(X[1]), next;
+   for (i = 2; i < n2; i++, prev = curr, curr = next)
+   {
+      X    = spectralBin(p, spectrum, i + 1);
+      next = sqrr(X[0]) + sqrr(X[1]);
+      if (curr > prev && curr >= next && (found < count || curr > sqrr(peaks[found - 1].height)))
+      {
+         // insert the peak in the order of the amplitudes
+         if (found < count)
+            found++;
+         for (j = found - 1; j > 0 && sqrr(peaks[j - 1].height) < curr; j--)
+            peaks[j] = peaks[j - 1];
+
+         double delta;
+         if (interpolation == quinn)
+         {
+            const real *Xm = spectralBin(p, spectrum, i - 1),
+                       *X0 = spectralBin(p, spectrum, i),
+                       *Xp = spectralBin(p, spectrum, i + 1);
+            double ap = (Xp[0]*X0[0] + Xp[1]*X0[1])/curr,
+                   am = (Xm[0]*X0[0] + Xm[1]*X0[1])/curr,
+                   dp = -ap/(1 - ap),
+                   dm =  am/(1 - am);
+            delta = (dp + dm)/2 + quinnTau(dp*dp) - quinnTau(dm*dm);
+         }
+
+         else
+         {
+            double am = sqrt(prev), a0 = sqrt(curr), ap = sqrt(next);
+            delta = (am - ap)/(2*(am - 2*a0 + ap));
+         }
+
+         if (!(fabs(delta) <= 0.5))
+            delta = 0;
+
+         peaks[j] = (spectral_peak){(i + delta)/n, 0, 0, (i + delta)/n, sqrt(curr)};
+      }
+   }
+
+   return found;
+}
+
+// Fit the peaks jointly to the detrended series x, given in the real parts scaled by n, which
+// is the backward transform of the spectrum. Return the RMS of the residuals.
+double fitPeaks(series *s, const real *x, spectral_peak *peaks, int count, int threads)
+{
+   int    i, j, c, iter, P = 3*count + 2;
+   size_t n = s->n;
+
+   fit_job f = {n, (n + PEAK_BLOCK - 1)/PEAK_BLOCK, threads, count, P, (n - 1)/2.0, x};
+   if (f.chunks > f.blocks)
+      f.chunks = f.blocks;
+   f.sums    = malloc(f.chunks*sizeof(double *));
+   f.columns = malloc(f.chunks*sizeof(double *));
+   for (c = 0; c < f.chunks; c++)
+   {
+      f.sums[c]    = malloc((P*P + P + 1)*sizeof(double));
+      f.columns[c] = malloc((P + 1)*PEAK_BLOCK*sizeof(double));
+   }
+
+   double *theta = calloc(P, sizeof(double)),
+          *trial = malloc(P*sizeof(double)),
+          *sum   = malloc((P*P + P + 1)*sizeof(double)),
+          *tsum  = malloc((P*P + P + 1)*sizeof(double)),
+          *A     = malloc(P*P*sizeof(double)),
+          *delta = malloc(P*sizeof(double));
+   for (j = 0; j < count; j++)
+      theta[3*j + 4] = 2*M_PI*peaks[j].freq;
+
+   // with the amplitudes being zero, the model is linear in the line and the amplitudes,
+   // and the first step solves for them with the frequencies held fixed
+   double sse = fitEvaluate(&f, theta, true, threads, sum), lambda = 1e-3;
+   memcpy(A, sum, P*P*sizeof(double));
+   memcpy(delta, sum + P*P, P*sizeof(double));
+   for (j = 0; j < count; j++)
+   {
+      for (i = 0; i < P; i++)
+         A[(3*j + 4)*P + i] = A[i*P + 3*j + 4] = 0;
+      A[(3*j + 4)*P + 3*j + 4] = 1;
+      delta[3*j + 4] = 0;
+   }
+   if (choleskySolve(A, delta, P))
+      for (i = 0; i < P; i++)
+         theta[i] += delta[i];
+
+   // Levenberg-Marquardt iterations on all parameters
+   sse = fitEvaluate(&f, theta, true, threads, sum);
+   for (iter = 0; iter < FIT_ITERATIONS && sse > 0; iter++)
+   {
+      double trialsse = INFINITY;
+      while (lambda < 1e12)
+      {
+         memcpy(A, sum, P*P*sizeof(double));
+         memcpy(delta, sum + P*P, P*sizeof(double));
+         for (i = 0; i < P; i++)
+            A[i*P + i] *= 1 + lambda;
+
+         bool valid = choleskySolve(A, delta, P);
+         for (i = 0; i < P; i++)
+            trial[i] = theta[i] + delta[i];
+         for (j = 0; valid && j < count; j++)
+            valid = trial[3*j + 4] > 0 && trial[3*j + 4] < M_PI;
+
+         if (valid && (trialsse = fitEvaluate(&f, trial, false, threads, tsum)) < sse)
+            break;
+         lambda *= 10;
+      }
+
+      if (!(trialsse < sse))
+         break;
+
+      bool converged = sse - trialsse < FIT_TOLERANCE*sse;
+      memcpy(theta, trial, P*sizeof(double));
+      sse = fitEvaluate(&f, theta, true, threads, sum);
+      lambda = (lambda > 1e-9) ? lambda/10 : lambda;
+      if (converged)
+         break;
+   }
+
+   for (j = 0; j < count; j++)
+   {
+      peaks[j].a    = theta[3*j + 2];
+      peaks[j].b    = theta[3*j + 3];
+      peaks[j].freq = theta[3*j + 4]/(2*M_PI);
+   }
+
+   free(delta);
+   free(A);
+   free(tsum);
+   free(sum);
+   free(trial);
+   free(theta);
+   for (c = 0; c < f.chunks; c++)
+   {
+      free(f.columns[c]);
+      free(f.sums[c]);
+   }
+   free(f.columns);
+   free(f.sums);
+
+   return sqrt(sse/n);
+}
+
+// Write the table of the fitted peaks in the order of their amplitudes. The phase φ refers
+// to the first time point, i.e. the sinusoid is |At|·cos(2π·freq·i + φ) for the points i.
+void writePeaks(FILE *outfile, series *s, spectral_peak *peaks, int count, double rms)
+{
+   int    i, j;
+   double center = (s->n - 1)/2.0;
+
+   for (i = 1; i < count; i++)
+      for (j = i; j > 0 && hypot(peaks[j - 1].a, peaks[j - 1].b) < hypot(peaks[j].a, peaks[j].b); j--)
+      {
+         spectral_peak t = peaks[j];
+         peaks[j] = peaks[j - 1];
+         peaks[j - 1] = t;
+      }
+
+   fprintf(outfile, "# Peak count:  %d\n", count);
+   fprintf(outfile, "# Residual RMS: %.9g\n", rms);
+   fprintf(outfile, "period/%s\tfreq/%.4g/%s\t|At|/µhsp\tphase/rad\tspectral/%.4g/%s\t|Xs|/µhsp\n",
+           s->timeunit, s->timebase, s->timeunit, s->timebase, s->timeunit);
+   for (i = 0; i < count; i++)
+   {
+      spectral_peak *q = &peaks[i];
+      double phase = remainder(-2*M_PI*q->freq*center - atan2(q->b, q->a), 2*M_PI);
+      fprintf(outfile, "%.9g\t%.12f\t%.9f\t%.6f\t%.12f\t%.9f\n",
+              s->timebase/q->freq, q->freq, hypot(q->a, q->b), phase, q->spectral, q->height/(s->n >> 1));
+   }
+}
+
+
+// Analysis Server
+
+// The server listens on a local socket, and it answers one request line per connection:
+//    spectrum <file> [binary]
+//    filter <file> <low> <high> <kT> [binary]
+//    band <file> <low> <high>
+// The series are loaded on their first request, and their forward spectra are kept resident
+// until the file has been modified. The requests are served by a pool of worker threads, which
+// all accept the connections on the same socket, and which share the plans of the plan cache.
+// Binary responses consist of the number of values as uint64_t followed by the values as reals.
+// The list of the resident series is kept in the order of their last use, and it is cut back to
+// the MAX_RESIDENTS most recently used ones. Connections, which do not send or receive anything
+// within SERVE_TIMEOUT seconds, are dropped. SIGINT and SIGTERM shut the server down, and remove
+// the socket.
+
+#define MAX_RESIDENTS 16
+#define SERVE_TIMEOUT 10
+
+typedef struct resident
+{
+   struct resident *next;
+   char     *path;
+   time_t    mtime;
+   off_t     size;
+   int       refs;        // one for the list, and one for each request in progress
+   series    s;
+   real     *spectrum;    // in natural order
+} resident;
+
+static pthread_mutex_t residentLock = PTHREAD_MUTEX_INITIALIZER;
+static resident       *residents    = NULL;
+
+static void residentFree(resident *r)
+{
+   free(r->spectrum);
+   free(r->s.time.t);
+   free(r->path);
+   free(r);
+}
+
+void residentRelease(resident *r)
+{
+   pthread_mutex_lock(&residentLock);
+   bool last = --r->refs == 0;
+   pthread_mutex_unlock(&residentLock);
+
+   if (last)
+      residentFree(r);
+}
+
+// look up the resident series of the file, and load it, if it is missing or outdated
+resident *residentAcquire(const char *path)
+{
+   struct stat st;
+   resident   *r, **link;
+   FILE       *file;
+   bool        exists = stat(path, &st) == 0;
+
+   // a hit is moved to the front of the list, and an outdated entry or one of a deleted file is dropped
+   pthread_mutex_lock(&residentLock);
+   for (link = &residents; r = *link; link = &r->next)
+      if (strcmp(r->path, path) == 0)
+      {
+         *link = r->next;
+         if (exists && r->mtime == st.st_mtime && r->size == st.st_size)
+         {
+            r->next = residents;
+            residents = r;
+            r->refs++;
+         }
+         else
+         {
+            if (--r->refs == 0)
+               residentFree(r);
+            r = NULL;
+         }
+         break;
+      }
+   pthread_mutex_unlock(&residentLock);
+
+   if (r || !exists || !(file = fopen(path, "r")))
+      return r;
+
+   r = calloc(1, sizeof(resident));
+   r->path  = strdup(path);
+   r->mtime = st.st_mtime;
+   r->size  = st.st_size;
+   r->refs  = 2;
+
+   real *input = NULL;
+   bool  valid = readHeader(file, NULL, 1, &r->s);
+   if (valid)
+   {
+      posix_memalign((void **)&input,       32, 2*r->s.n*sizeof(real));
+      posix_memalign((void **)&r->spectrum, 32, 2*r->s.n*sizeof(real));
+      if (valid = readData(file, &r->s, input))
+      {
+         fft_plan *p = planCheckout(r->s.n, FFT_FORWARD, 1, false);
+         fftExecute(p, input, r->spectrum);
+         planCheckin(p);
+      }
+   }
+   free(input);
+   fclose(file);
+
+   if (!valid)
+   {
+      residentFree(r);
+      return NULL;
+   }
+
+   // another worker may have loaded the same file in the meantime
+   resident *q, *old;
+   int       k;
+   pthread_mutex_lock(&residentLock);
+   for (q = residents; q; q = q->next)
+      if (strcmp(q->path, path) == 0 && q->mtime == r->mtime && q->size == r->size)
+      {
+         q->refs++;
+         break;
+      }
+   if (!q)
+   {
+      r->next = residents;
+      residents = r;
+
+      // drop the least recently used series beyond the limit
+      for (link = &residents, k = 0; *link && k < MAX_RESIDENTS; link = &(*link)->next, k++);
+      while (old = *link)
+      {
+         *link = old->next;
+         if (--old->refs == 0)
+            residentFree(old);
+      }
+   }
+   pthread_mutex_unlock(&residentLock);
+
+   if (q)
+   {
+      residentFree(r);
+      r = q;
+   }
+
+   return r;
+}
+
+static void writeHeader(FILE *out, series *s)
+{
+   fprintf(out, "# Time base:   %.9g\n"
+                "# Time unit:   %s\n"
+                "# Point count: %zu\n", s->timebase, s->timeunit, s->n);
+}
+
+static void serveRequest(int fd)
+{
+   char   *argv[8], *save, req[4096];
+   int     argc = 0;
+   ssize_t k, len = 0;
+
+   while (len < sizeof(req) - 1 && (k = read(fd, req + len, sizeof(req) - 1 - len)) > 0)
+      if (memchr(req + (len += k) - k, '\n', k))
+         break;
+   req[len] = '\0';
+
+   FILE *out = fdopen(fd, "w");
+   if (!out)
+   {
+      close(fd);
+      return;
+   }
+
+   for (char *tok = strtok_r(req, " \t\r\n", &save); tok && argc < 8; tok = strtok_r(NULL, " \t\r\n", &save))
+      argv[argc++] = tok;
+
+   bool      binary = argc > 0 && strcmp(argv[argc-1], "binary") == 0;
+   resident *r      = (argc - binary >= 2) ? residentAcquire(argv[1]) : NULL;
+
+   if (!r)
+      fprintf(out, "# Error: invalid request or series\n");
+
+   else
+   {
+      series *s = &r->s;
+      size_t  i, n = s->n, n2 = n >> 1;
+      float   lowCut, highCut, kT;
+
+      if (argc - binary == 2 && strcmp(argv[0], "spectrum") == 0)
+      {
+         if (binary)
+         {
+            uint64_t count = n2 + 1;
+            fwrite(&count, sizeof(count), 1, out);
+            for (i = 0; i <= n2; i++)
+            {
+               real A = (real)sqrt(sqrr(r->spectrum[2*i]) + sqrr(r->spectrum[2*i+1]))/n2;
+               fwrite(&A, sizeof(real), 1, out);
+            }
+         }
+
+         else
+         {
+            writeHeader(out, s);
+            writeSpectrum(out, s, NULL, r->spectrum);
+         }
+      }
+
+      else if (argc - binary == 5 && strcmp(argv[0], "filter") == 0
+            && parseCuts((const char **)argv + 2, &lowCut, &highCut, &kT))
+      {
+         real *X, *Y;
+         posix_memalign((void **)&X, 32, 2*n*sizeof(real));
+         posix_memalign((void **)&Y, 32, 2*n*sizeof(real));
+         memcpy(X, r->spectrum, 2*n*sizeof(real));
+         maskSpectrum(s, NULL, X, lowCut, highCut, kT);
+
+         fft_plan *p = planCheckout(n, FFT_BACKWARD, 1, false);
+         fftExecute(p, X, Y);
+         planCheckin(p);
+
+         if (binary)
+         {
+            uint64_t count = n;
+            fwrite(&count, sizeof(count), 1, out);
+            for (i = 0; i < n; i++)
+            {
+               real y = Y[2*i]/n + ((s->trend) ? s->a + s->b*i : 0);
+               fwrite(&y, sizeof(real), 1, out);
+            }
+         }
+
+         else
+         {
+            writeHeader(out, s);
+            writeFiltered(out, s, Y, 1);
+         }
+
+         free(Y);
+         free(X);
+      }
+
+      else if (argc == 4 && strcmp(argv[0], "band") == 0)
+      {
+         // the RMS amplitude of the band, and the frequency and amplitude of its strongest line
+         double low  = strtod(argv[2], NULL),
+                high = strtod(argv[3], NULL),
+                power = 0, peak = 0, A;
+         size_t kpeak = 0;
+
+         for (i = (low > 0) ? (size_t)ceil(low*n) : 1; i <= n2 && i <= high*n; i++)
+         {
+            A = sqrr(r->spectrum[2*i]) + sqrr(r->spectrum[2*i+1]);
+            power += (2*i == n) ? A : 2*A;
+            if (peak < A)
+               peak = A, kpeak = i;
+         }
+
+         fprintf(out, "low/%.4g/%s\thigh/%.4g/%s\trms/µhsp\tfreq/%.4g/%s\t|At|/µhsp\n",
+                 s->timebase, s->timeunit, s->timebase, s->timeunit, s->timebase, s->timeunit);
+         fprintf(out, "%.12f\t%.12f\t%.9f\t%.12f\t%.9f\n", low, high, sqrt(power)/n, (double)kpeak/n, sqrt(peak)/n2);
+      }
+
+      else
+         fprintf(out, "# Error: invalid request\n");
+
+      residentRelease(r);
+   }
+
+   fclose(out);
+}
+
+static bool serveFailed = false;
+
+static void *serveWorker(void *arg)
+{
+   int fd, sock = *(int *)arg;
+   struct timeval timeout = {SERVE_TIMEOUT, 0};
+
+   while ((fd = accept(sock, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+      if (fd >= 0)
+      {
+         // idle or stalled clients must not tie up the worker
+         setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+         setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+         serveRequest(fd);
+      }
+
+   // let the main thread shut the server down
+   perror("accept");
+   __atomic_store_n(&serveFailed, true, __ATOMIC_RELAXED);
+   kill(getpid(), SIGTERM);
+   return NULL;
+}
+
+// remove a stale socket at path, but never anything else
+static bool removeSocket(const char *path)
+{
+   struct stat st;
+
+   if (lstat(path, &st) != 0)
+      return errno == ENOENT;
+
+   if (!S_ISSOCK(st.st_mode))
+   {
+      fprintf(stderr, "%s: exists and is not a socket\n", path);
+      return false;
+   }
+
+   return unlink(path) == 0;
+}
+
+int serve(const char *path, int threads)
+{
+   struct sockaddr_un addr = {.sun_family = AF_UNIX};
+   int      sock, t, sig;
+   sigset_t stop;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return usage();
+   strcpy(addr.sun_path, path);
+
+   if (!removeSocket(path))
+      return 1;
+
+   // the workers inherit the blocked signals, which are awaited by the main thread
+   sigemptyset(&stop);
+   sigaddset(&stop, SIGINT);
+   sigaddset(&stop, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+   signal(SIGPIPE, SIG_IGN);
+   if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+    || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0
+    || listen(sock, 64) != 0)
+   {
+      perror(path);
+      return 1;
+   }
+
+   pthread_t tid;
+   for (t = 0; t < threads; t++)
+      if (pthread_create(&tid, NULL, serveWorker, &sock) == 0)
+         pthread_detach(tid);
+
+   sigwait(&stop, &sig);
+
+   // the workers and the listening socket end with the process
+   removeSocket(path);
+   return (__atomic_load_n(&serveFailed, __ATOMIC_RELAXED)) ? 1 : 0;
+}
+
+// send the request line to the server, and copy the response to stdout
+int query(const char *path, int argc, const char *argv[])
+{
+   struct sockaddr_un addr = {.sun_family = AF_UNIX};
+   int    fd, i;
+   char   buf[65536];
+   size_t k;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return usage();
+   strcpy(addr.sun_path, path);
+
+   if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+    || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+   {
+      perror(path);
+      return 1;
+   }
+
+   FILE *conn = fdopen(fd, "r+");
+   for (i = 0; i < argc; i++)
+      fprintf(conn, (i < argc - 1) ? "%s " : "%s\n", argv[i]);
+   fflush(conn);
+   shutdown(fd, SHUT_WR);
+
+   while ((k = fread(buf, 1, sizeof(buf), conn)) > 0)
+      fwrite(buf, 1, k, stdout);
+
+   fclose(conn);
+   return 0;
+}
+
+
+enum { spectrum = 1, filter = 0, smooth = 2, wavelet = 3, peaks = 4 };
+
+int main(int argc, const char *argv[])
+{
+   FILE *infile, *outfile;
+
+   int   rc      = 0,
+         argidx  = 1,
+         method  = 0,
+         threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+   bool  lowmem  = false;
+
+   size_t decimation = 1;
+
+   const char *cachefile = NULL;
+
+   int   smoothKind  = smoothMean,
+         smoothWidth = 1;
+
+   int    peakCount     = 5,
+          interpolation = quinn;
+
+   int    mother = morlet;
+   double param  = 6,
+          dj     = 0.125;
+
+   float lowCut  = 0.0f,
+         highCut = INFINITY,
+         kT      = 0.0f;
+
+   for (; argidx < argc && *argv[argidx] == '-' && argv[argidx][1] != '\0'; argidx++)
+      if (strcmp(argv[argidx], "-t") == 0 && argidx + 1 < argc)
+      {
+         if ((threads = (int)strtol(argv[++argidx], NULL, 10)) < 1)
+            return usage();
+      }
+
+      else if (strcmp(argv[argidx], "-m") == 0)
+         lowmem = true;
+
+      else if (strcmp(argv[argidx], "-c") == 0 && argidx + 1 < argc)
+         cachefile = argv[++argidx];
+
+      else if (strcmp(argv[argidx], "-d") == 0 && argidx + 1 < argc)
+      {
+         long d = strtol(argv[++argidx], NULL, 10);
+         if (d < 1 || 1000000 < d)
+            return usage();
+         decimation = d;
+      }
+
+      else
+         return usage();
+
+   if (argc - argidx == 2 && strcmp(argv[argidx], "serve") == 0)
+      return serve(argv[argidx + 1], threads);
+
+   else if (argc - argidx >= 3 && strcmp(argv[argidx], "query") == 0)
+      return query(argv[argidx + 1], argc - argidx - 2, argv + argidx + 2);
+
+   else if (argc - argidx == 3 && strcmp(argv[argidx], "spectrum") == 0)
+      method = spectrum;
+
+   else if (argc - argidx == 5 && strcmp(argv[argidx], "smooth") == 0)
+   {
+      method = smooth;
+      argidx++;
+      if (strcmp(argv[argidx], "mean") == 0)
+         smoothKind = smoothMean;
+      else if (strcmp(argv[argidx], "boxcar") == 0)
+         smoothKind = smoothBoxcar;
+      else if (strcmp(argv[argidx], "exp") == 0)
+         smoothKind = smoothExp;
+      else if (strcmp(argv[argidx], "sg") == 0)
+         smoothKind = smoothSG;
+      else
+         return usage();
+
+      smoothWidth = (int)strtol(argv[++argidx], NULL, 10);
+      if (smoothWidth < 1 || 100000 < smoothWidth
+       || smoothKind == smoothSG && (smoothWidth < 3 || (smoothWidth & 0x1) == 0))
+         return usage();
+   }
+
+   else if (argc - argidx == 6 && strcmp(argv[argidx], "wavelet") == 0)
+   {
+      method = wavelet;
+      argidx++;
+      if (strcmp(argv[argidx], "morlet") == 0)
+         mother = morlet;
+      else if (strcmp(argv[argidx], "paul") == 0)
+         mother = paul;
+      else
+         return usage();
+
+      param = strtod(argv[++argidx], NULL);
+      dj    = strtod(argv[++argidx], NULL);
+      if (!(param > 0 && param <= 100) || !(dj > 0 && dj <= 1)
+       || mother == paul && param < 1)
+         return usage();
+   }
+
+   else if (argc - argidx == 5 && strcmp(argv[argidx], "peaks") == 0)
+   {
+      method = peaks;
+      peakCount = (int)strtol(argv[++argidx], NULL, 10);
+      if (peakCount < 1 || MAX_PEAKS < peakCount)
+         return usage();
+
+      argidx++;
+      if (strcmp(argv[argidx], "parabolic") == 0)
+         interpolation = parabolic;
+      else if (strcmp(argv[argidx], "quinn") == 0)
+         interpolation = quinn;
+      else
+         return usage();
+   }
+
+   else if (argc - argidx == 6 && strcmp(argv[argidx], "filter") == 0)
+   {
+      method = filter;
+      if (!parseCuts(argv + argidx + 1, &lowCut, &highCut, &kT))
+         return usage();
+      argidx += 3;
+   }
+
+   else
+      return usage();
+
+   if (decimation > 1 && method != filter)
+      return usage();
+
+   // decimation aliases everything above half of the decimated sampling rate, and so the
+   // filter must be a low or band pass, whose high cut stays below this limit, including
+   // the blur of the cut down to an attenuation of 0.1 %
+   if (decimation > 1 && (lowCut > highCut || !(highCut + 7*kT*(highCut - lowCut)/100 <= 0.5/decimation)))
+   {
+      fprintf(stderr, "Decimation by %zu requires a pass band below %g including the blur of the cut.\n", decimation, 0.5/decimation);
+      return usage();
+   }
+
+   if (infile = (*(uint16_t *)argv[++argidx] == *(uint16_t *)"-")
+                 ? stdin
+                 : fopen(argv[argidx], "r"))
+   {
+      if (outfile = (*(uint16_t *)argv[++argidx] == *(uint16_t *)"-")
+                    ? stdout
+                    : fopen(argv[argidx], "w"))
+      {
+         if (method == smooth)
+            rc = smoothSeries(infile, outfile, smoothKind, smoothWidth, argc, argv);
+
+         else
+         {
+            series s;
+            bool   valid;
+
+            if (valid = readHeader(infile, outfile, (method == filter) ? decimation : 1, &s))
+            {
+               size_t    n = s.n;
+               fft_plan *p = fftInit(n, FFT_FORWARD, threads, lowmem);
+
+               // the spectrum cache is keyed by the hash of the input file and the number of points
+               uint64_t      hash  = 0;
+               char         *cpath = NULL;
+               cache_header *cache = NULL;
+               size_t        csize = 0;
+               if (cachefile)
+                  if (hash = hashStream(infile))
+                  {
+                     cpath = cachePath(cachefile, hash, n, (uint32_t)fftIndex(p, 1));
+                     cache = cacheLoad(cpath, hash, n, (uint32_t)fftIndex(p, 1), &csize);
+                  }
+                  else
+                     fprintf(stderr, "The spectrum cache needs a seekable input file.\n");
+
+               real *input, *output;
+
+               if (cache)
+               {
+                  s.trend    = cache->trend;
+                  s.a        = cache->a;
+                  s.b        = cache->b;
+                  s.variance = cache->variance;
+                  s.time.model = cache->model;
+                  s.time.t0    = cache->t0;
+                  s.time.day0  = cache->day0;
+                  if (s.time.model == timeStored)
+                     s.time.t = (double *)((char *)cache + CACHE_DATA + 2*n*sizeof(real));
+
+                  output = (real *)((char *)cache + CACHE_DATA);
+                  if (lowmem)
+                     input = output;
+                  else
+                     posix_memalign((void **)&input, 32, 2*n*sizeof(real));
+               }
+
+               else
+               {
+                  // in low memory mode, the transforms are done in place
+                  posix_memalign((void **)&input,  32, 2*n*sizeof(real));
+                  if (lowmem)
+                     output = input;
+                  else
+                     posix_memalign((void **)&output, 32, 2*n*sizeof(real));
+
+                  if (valid = readData(infile, &s, input))
+                  {
+                     fftExecute(p, input, output);
+
+                     if (cpath)
+                        cacheStore(cpath, &(cache_header){"cyclasar", hash, n, sizeof(real), (uint32_t)fftIndex(p, 1), s.trend, s.time.model,
+                                                          s.a, s.b, s.variance, s.time.t0, s.time.day0}, output, s.time.t);
+                  }
+               }
+
+               if (valid && method == spectrum)
+                  writeSpectrum(outfile, &s, p, output);
+
+               else if (valid && method == wavelet)
+               {
+                  // add the wavelet command line to the header of the output file
+                  writeCommandLine(outfile, argc, argv);
+                  waveletScalogram(outfile, mother, param, dj, threads, &s, p, output);
+               }
+
+               else if (valid && method == peaks)
+               {
+                  // add the peaks command line to the header of the output file
+                  writeCommandLine(outfile, argc, argv);
+                  spectral_peak found[MAX_PEAKS];
+                  int count = findPeaks(&s, p, output, peakCount, interpolation, found);
+
+                  // the series for the fit is recovered from the spectrum, which is at hand
+                  // alike when it has been transformed in place or loaded from the cache
+                  fftFree(p);
+                  p = fftInit(n, FFT_BACKWARD, threads, lowmem);
+                  fftExecute(p, output, input);
+                  writePeaks(outfile, &s, found, count, fitPeaks(&s, input, found, count, threads));
+               }
+
+               else if (valid && method == filter)
+               {
+                  // add the filter command line to the header of the output file
+                  writeCommandLine(outfile, argc, argv);
+                  maskSpectrum(&s, p, output, lowCut, highCut, kT);
+
+                  if (decimation > 1 && n % decimation == 0)
+                  {
+                     // decimate by transforming the folded spectrum backwards
+                     size_t    m = n/decimation;
+                     fft_plan *q = fftInit(m, FFT_BACKWARD, threads, lowmem);
+                     real     *folded;
+                     posix_memalign((void **)&folded, 32, 2*m*sizeof(real));
+                     foldSpectrum(&s, p, output, decimation, q, folded);
+                     fftExecute(q, folded, (lowmem) ? folded : input);
+                     writeFiltered(outfile, &s, (lowmem) ? folded : input, decimation);
+                     fftFree(q);
+                     free(folded);
+                  }
+
+                  else
+                  {
+                     fftFree(p);
+                     p = fftInit(n, FFT_BACKWARD, threads, lowmem);
+                     fftExecute(p, output, input);
+
+                     // otherwise pick every decimation-th point of the full backward transform
+                     for (size_t i = 1, j = decimation; j < n; i++, j += decimation)
+                     {
+                        input[2*i]     = input[2*j];
+                        input[2*i + 1] = input[2*j + 1];
+                     }
+                     writeFiltered(outfile, &s, input, decimation);
+                  }
+               }
+
+               fftFree(p);
+               if (cache)
+               {
+                  munmap(cache, csize);
+                  if (input != output)
+                     free(input);
+               }
+
+               else
+               {
+                  if (output != input)
+                     free(output);
+                  free(input);
+                  free(s.time.t);
+               }
+               free(cpath);
+            }
+
+            if (!valid)
+            {
+               printf("Invalid number of Points\n");
+               rc = usage();
+            }
          }
 
          if (outfile != stdout)
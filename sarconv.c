@@ -41,6 +41,12 @@
 //
 //     ./sarconv daily_area.txt sar-1880-2021.tsv
 //
+//     Alternatively aggregate the daily values to monthly, yearly or Carrington rotation periods,
+//     and write out the mean, minimum, maximum and valid-count of each period. Monthly and yearly
+//     periods are time stamped at their middle in the same way as cagconv does it:
+//
+//     ./sarconv monthly daily_area.txt sar-monthly-1880-2021.tsv
+//
 //  4. Open the TSV file with your favorite graphing and/or data analysis application,
 //     for example with CVA - https://cyclaero.com/en/downloads/CVA
 
@@ -49,12 +55,23 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 //                           -    1    2     3     4      5      6      7      8      9     10     11     12
 double commYearSteps[13] = {0.0, 0.0, 31.0, 59.0, 90.0, 120.0, 151.0, 181.0, 212.0, 243.0, 273.0, 304.0, 334.0};
 double leapYearSteps[13] = {0.0, 0.0, 31.0, 60.0, 91.0, 121.0, 152.0, 182.0, 213.0, 244.0, 274.0, 305.0, 335.0};
 
+// the middle of the year [0] and of the months [1..12] - see cagconv
+//                           -     1     2     3      4      5      6      7      8      9     10     11     12
+double commYearMids[13] = {182.5, 15.5, 45.0, 74.5, 105.0, 135.5, 166.0, 196.5, 227.5, 258.0, 288.5, 319.0, 349.5};
+double leapYearMids[13] = {183.0, 15.5, 45.5, 75.5, 106.0, 136.5, 167.0, 197.5, 228.5, 259.0, 289.5, 320.0, 350.5};
+
+// Carrington rotation 1690 started at JD 2444235.34, the synodic rotation period is 27.2753 d
+#define CARRINGTON_EPOCH  2444235.34
+#define CARRINGTON_PERIOD 27.2753
+#define UNIX_EPOCH_JD     2440587.5
+
 static inline bool isLeapYear(int year)
 {
    return (year % 4)
@@ -87,17 +104,169 @@ static inline double linpol(double t, double t1, double y1, double t2, double y2
    return (y2 - y1)/(t2 - t1)*(t - t1) + y1;
 }
 
+// days since 1970-01-01 of the given date of the proleptic gregorian calendar
+static inline long daysFromCivil(int y, int m, int d)
+{
+   y -= m <= 2;
+   long era = (y >= 0 ? y : y - 399)/400;
+   long yoe = y - era*400;
+   long doy = (153*(m + ((m > 2) ? -3 : 9)) + 2)/5 + d - 1;
+   return era*146097 + yoe*365 + yoe/4 - yoe/100 + doy - 719468;
+}
+
+// decimal year of the given fractional days since 1970-01-01 00:00
+static inline double decimalYear(double days)
+{
+   int y = 1970 + (int)floor(days/365.2425);
+   while (daysFromCivil(y, 1, 1) > days)
+      y--;
+   while (daysFromCivil(y + 1, 1, 1) <= days)
+      y++;
+   return y + (days - daysFromCivil(y, 1, 1))/((isLeapYear(y)) ? 366.0 : 365.0);
+}
+
+
+enum { daily, monthly, yearly, carrington };
+
+typedef struct
+{
+   long   key;
+   double t;
+   double sum[3], min[3], max[3];
+   int    count[3];
+} aggregate;
+
+// the key of the period of the given date, and the decimal year of the middle of the period
+static long periodKey(int period, int y, int m, int d, double *t)
+{
+   long key;
+
+   switch (period)
+   {
+      case monthly:
+         *t = y + ((isLeapYear(y))
+                  ? leapYearMids[m]/366.0
+                  : commYearMids[m]/365.0);
+         return y*12L + m - 1;
+
+      case yearly:
+         *t = y + ((isLeapYear(y))
+                  ? leapYearMids[0]/366.0
+                  : commYearMids[0]/365.0);
+         return y;
+
+      default:
+         // the JD at noon of the given date
+         key = (long)floor(1690 + (daysFromCivil(y, m, d) + UNIX_EPOCH_JD + 0.5 - CARRINGTON_EPOCH)/CARRINGTON_PERIOD);
+         *t = decimalYear(CARRINGTON_EPOCH + (key - 1690 + 0.5)*CARRINGTON_PERIOD - UNIX_EPOCH_JD);
+         return key;
+   }
+}
+
+// add the valid (non-negative) values of a day to the aggregate of its period
+static void aggregateDay(aggregate *a, const double v[3])
+{
+   for (int c = 0; c < 3; c++)
+      if (v[c] >= 0.0)
+      {
+         a->sum[c] += v[c];
+         if (a->min[c] > v[c])
+            a->min[c] = v[c];
+         if (a->max[c] < v[c])
+            a->max[c] = v[c];
+         a->count[c]++;
+      }
+}
+
+static inline bool aggregateIsZero(aggregate *a)
+{
+   return !(a->max[0] > 0.0 || a->max[1] > 0.0 || a->max[2] > 0.0);
+}
+
+// Write out the mean, minimum, maximum and valid-count of the periods, skipping the initial and
+// final periods without any active regions. The values of periods without valid days are
+// linearly interpolated in the same way as the missing daily values.
+static void writeAggregates(FILE *tsv, aggregate *agg, int n, int period)
+{
+   int c, i, k, m;
+
+   for (m = n-1; m >= 0 && aggregateIsZero(&agg[m]); m--);
+   for (++m, i = 0; i < m && aggregateIsZero(&agg[i]); i++);
+
+   fprintf(tsv, "# Time base:   %s\n"
+                "# Time unit:   d\n"
+                "# Point count: %d\n", (period == monthly) ? "30.44" : (period == yearly) ? "365.2425" : "27.2753", m-i);
+
+   // Write the column header using SI formular symbols and units,
+   // and N for the number of valid days in the period.
+   fprintf(tsv, "t/a\tAt/µhsp\tAtmin/µhsp\tAtmax/µhsp\tNt"
+                  "\tAn/µhsp\tAnmin/µhsp\tAnmax/µhsp\tNn"
+                  "\tAs/µhsp\tAsmin/µhsp\tAsmax/µhsp\tNs\n");
+
+   double t1[3] = {agg[i].t, agg[i].t, agg[i].t},
+          a1[3] = {0.0, 0.0, 0.0};
+
+   for (; i < m; i++)
+   {
+      fprintf(tsv, "%.7f", agg[i].t);
+      for (c = 0; c < 3; c++)
+      {
+         if (agg[i].count[c] > 0)
+         {
+            t1[c] = agg[i].t;
+            a1[c] = agg[i].sum[c]/agg[i].count[c];
+            fprintf(tsv, "\t%.2f\t%.1f\t%.1f\t%d", a1[c], agg[i].min[c], agg[i].max[c], agg[i].count[c]);
+         }
+
+         else
+         {
+            double a = a1[c];
+            for (k = i; k < n && agg[k].count[c] == 0; k++);
+            if (k < n)
+               a = linpol(agg[i].t, t1[c], a1[c], agg[k].t, agg[k].sum[c]/agg[k].count[c]);
+            fprintf(tsv, "\t%.2f\t%.1f\t%.1f\t0", a, a, a);
+         }
+      }
+      fprintf(tsv, "\n");
+   }
+}
+
 int main(int argc, char *const argv[])
 {
    FILE *txt, *tsv;
 
-   if (txt = (*(uint16_t *)argv[1] == *(uint16_t *)"-")
+   int argidx = 1,
+       period = daily;
+
+   if (argc == 4)
+   {
+      if (strcmp(argv[argidx], "monthly") == 0)
+         period = monthly;
+      else if (strcmp(argv[argidx], "yearly") == 0)
+         period = yearly;
+      else if (strcmp(argv[argidx], "carrington") == 0)
+         period = carrington;
+      else
+         argc = 0;
+      argidx++;
+   }
+
+   if (argc != 3 && argc != 4)
+   {
+      printf(" Usage:\n"
+             "   ./sarconv [period] <infile> <outfile>\n"
+             "     period:  either of 'monthly', 'yearly' or 'carrington' - aggregate the daily values\n"
+             "\n");
+      return 1;
+   }
+
+   if (txt = (*(uint16_t *)argv[argidx] == *(uint16_t *)"-")
              ? stdin
-             : fopen(argv[1], "r"))
+             : fopen(argv[argidx], "r"))
    {
-      if (tsv = (*(uint16_t *)argv[2] == *(uint16_t *)"-")
+      if (tsv = (*(uint16_t *)argv[++argidx] == *(uint16_t *)"-")
                 ? stdout
-                : fopen(argv[2], "w"))
+                : fopen(argv[argidx], "w"))
       {
          unsigned
          char *line;
@@ -108,7 +277,51 @@ int main(int argc, char *const argv[])
              && (*(line = skip(line)) < '0' || '9' < *line))
             fprintf(tsv, "# %s", line);
 
-         if (line)
+         if (line && period != daily)
+         {
+            // Aggregate the days of each period in the single parsing pass.
+            int na = 0, cap = 2048;
+            aggregate *agg = malloc(cap*sizeof(aggregate));
+
+            do
+               if ('0' <= *line && *line <= '9' || *line == '-')
+               {
+                  char *q, *p = (char *)line;
+                  int   y = (int)strtol(p,     &q, 10),
+                        m = (int)strtol(p = q, &q, 10),
+                        d = (int)strtol(p = q, &q, 10);
+
+                  if (y >= 1880)
+                  {
+                     double t, v[3];
+                     long   key = periodKey(period, y, m, d, &t);
+
+                     v[0] = strtod(p = q, &q);
+                     v[1] = strtod(p = q, &q);
+                     v[2] = strtod(p = q, &q);
+
+                     if (na == 0 || agg[na-1].key != key)
+                     {
+                        if (na == cap)
+                           agg = realloc(agg, (cap += cap)*sizeof(aggregate));
+                        agg[na++] = (aggregate){key, t, {0.0, 0.0, 0.0}, {INFINITY, INFINITY, INFINITY}, {-INFINITY, -INFINITY, -INFINITY}, {0, 0, 0}};
+                     }
+
+                     aggregateDay(&agg[na-1], v);
+                  }
+                  else if (y == 0 && q == (char *)line)
+                     break;                                    // a number conversion error occurred
+               }
+            while ((line = (unsigned char *)fgets(data, 256, txt))
+                && *(line = skip(line)));
+
+            if (na > 0)
+               writeAggregates(tsv, agg, na, period);
+
+            free(agg);
+         }
+
+         else if (line)
          {
             int n = 0, cap = 65536;
             double *t  = malloc(cap*sizeof(double));
@@ -138,7 +351,7 @@ int main(int argc, char *const argv[])
                      an[n] = strtod(p = q, &q);
                      as[n] = strtod(p = q, &q);
 
-                     if (++n > cap)
+                     if (++n == cap)
                      {
                         cap += cap;
                         t  = realloc(t,  cap*sizeof(double));